@@ -57,9 +57,12 @@
 #include <sys/socketvar.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/time.h>
 
 #include <net/vnet.h>
 
+#include <vm/uma.h>
+
 #include <netinet/tcp.h>
 #include <netinet/tcp_seq.h>
 #include <netinet/tcp_timer.h>
@@ -68,34 +71,43 @@
 #include <cc_cubic_search.h>
 #include <netinet/cc/cc_module.h>
 
+#include "tcp_search.h"
+
 static void	cubic_ack_received(struct cc_var *ccv, uint16_t type);
 static void	cubic_cb_destroy(struct cc_var *ccv);
 static int	cubic_cb_init(struct cc_var *ccv);
 static void	cubic_cong_signal(struct cc_var *ccv, uint32_t type);
 static void	cubic_conn_init(struct cc_var *ccv);
 static int	cubic_mod_init(void);
+static void	cubic_mod_destroy(void);
 static void	cubic_post_recovery(struct cc_var *ccv);
 static void	cubic_record_rtt(struct cc_var *ccv);
 static void	cubic_ssthresh_update(struct cc_var *ccv, uint32_t maxseg);
 static void	cubic_after_idle(struct cc_var *ccv);
+static void	cubic_search_exit_slow_start(struct cc_var *ccv);
+static void	cubic_search_params_init(struct cc_var *ccv);
+static void	cubic_search_reset(struct cc_var *ccv);
+static void	cubic_search_update(struct cc_var *ccv);
 
+/*
+ * Everything cubic_record_rtt() and cubic_ack_received() touch on every ACK
+ * of slow start, up to the end of the open SEARCH bin, comes first and
+ * shares the first cache line of the item. The CUBIC window follows the
+ * bin ring, the rest is only read on congestion events.
+ */
 struct cubic {
-	/* Cubic K in fixed point form with CUBIC_SHIFT worth of precision. */
-	int64_t		K;
 	/* Sum of RTT samples across an epoch in ticks. */
 	int64_t		sum_rtt_ticks;
-	/* cwnd at the most recent congestion event. */
-	unsigned long	max_cwnd;
-	/* cwnd at the previous congestion event. */
-	unsigned long	prev_max_cwnd;
-	/* A copy of prev_max_cwnd. Used for CC_RTO_ERR */
-	unsigned long	prev_max_cwnd_cp;
+	/* Bytes acked since the connection started, fed into SEARCH bins. */
+	uint64_t	search_bytes_acked;
 	/* various flags */
 	uint32_t	flags;
 #define CUBICFLAG_CONG_EVENT	0x00000001	/* congestion experienced */
 #define CUBICFLAG_IN_SLOWSTART	0x00000002	/* in slow start */
 #define CUBICFLAG_IN_APPLIMIT	0x00000004	/* application limited */
 #define CUBICFLAG_RTO_EVENT	0x00000008	/* RTO experienced */
+#define CUBICFLAG_SEARCH_DONE	0x00000010	/* SEARCH exit point found */
+#define CUBICFLAG_SEARCH	0x00000020	/* SEARCH enabled at creation */
 	/* Minimum observed rtt in ticks. */
 	int		min_rtt_ticks;
 	/* Mean observed rtt between congestion epochs. */
@@ -106,14 +118,45 @@ struct cubic {
 	 * congestion event.
 	 */
 	int		t_last_cong;
+	/* SEARCH tunables, taken when the connection was created. */
+	struct search_params search_params;
+	/* SEARCH bins and clock, the state of the Linux module. */
+	struct search_state search;
+
+	/* Cubic K in fixed point form with CUBIC_SHIFT worth of precision. */
+	int64_t		K;
+	/* cwnd at the most recent congestion event. */
+	unsigned long	max_cwnd;
+	/* cwnd at the previous congestion event. */
+	unsigned long	prev_max_cwnd;
+	/* A copy of prev_max_cwnd. Used for CC_RTO_ERR */
+	unsigned long	prev_max_cwnd_cp;
 	/* Timestamp (in ticks) of a previous congestion event. Used for
 	 * CC_RTO_ERR.
 	 */
 	int		t_last_cong_prev;
 };
 
-static MALLOC_DEFINE(M_CUBIC, "cubic data",
-    "Per connection data required for the CUBIC congestion control algorithm");
+CTASSERT(__offsetof(struct cubic, search.bin_end_us) + sizeof(uint32_t) <=
+    CACHE_LINE_SIZE);
+
+/*
+ * Per connection data, from a zone rather than malloc(9) so that connection
+ * setup and teardown mostly hit the per-CPU caches. Items are cache line
+ * aligned for the layout above.
+ */
+static uma_zone_t cubic_zone;
+
+VNET_DEFINE_STATIC(uint32_t, cubic_search) = 1;
+VNET_DEFINE_STATIC(uint32_t, cubic_search_window_size_time) = 35;
+VNET_DEFINE_STATIC(uint32_t, cubic_search_thresh) = 35;
+VNET_DEFINE_STATIC(uint32_t, cubic_search_cwnd_rollback) = 1;
+VNET_DEFINE_STATIC(uint32_t, cubic_search_do_intpld) = 1;
+#define	V_cubic_search			VNET(cubic_search)
+#define	V_cubic_search_window_size_time	VNET(cubic_search_window_size_time)
+#define	V_cubic_search_thresh		VNET(cubic_search_thresh)
+#define	V_cubic_search_cwnd_rollback	VNET(cubic_search_cwnd_rollback)
+#define	V_cubic_search_do_intpld	VNET(cubic_search_do_intpld)
 
 struct cc_algo cubic_cc_algo = {
 	.name = "cubic_search",
@@ -123,6 +166,7 @@ struct cc_algo cubic_cc_algo = {
 	.cong_signal = cubic_cong_signal,
 	.conn_init = cubic_conn_init,
 	.mod_init = cubic_mod_init,
+	.mod_destroy = cubic_mod_destroy,
 	.post_recovery = cubic_post_recovery,
 	.after_idle = cubic_after_idle,
 };
@@ -137,6 +181,21 @@ cubic_ack_received(struct cc_var *ccv, uint16_t type)
 	cubic_data = ccv->cc_data;
 	cubic_record_rtt(ccv);
 
+	/*
+	 * SEARCH samples every ACK while in slow start, the same way the
+	 * Linux module does from pkts_acked.
+	 */
+	if (type == CC_ACK) {
+		cubic_data->search_bytes_acked += ccv->bytes_this_ack;
+		if ((cubic_data->flags & (CUBICFLAG_SEARCH |
+		    CUBICFLAG_SEARCH_DONE)) == CUBICFLAG_SEARCH) {
+			if (CCV(ccv, snd_cwnd) > CCV(ccv, snd_ssthresh))
+				cubic_data->flags |= CUBICFLAG_SEARCH_DONE;
+			else
+				cubic_search_update(ccv);
+		}
+	}
+
 	/*
 	 * For a regular ACK and we're not in cong/fast recovery and
 	 * we're cwnd limited, always recalculate cwnd.
@@ -243,12 +302,15 @@ cubic_after_idle(struct cc_var *ccv)
 
 	newreno_cc_algo.after_idle(ccv);
 	cubic_data->t_last_cong = ticks;
+
+	if (cubic_data->flags & CUBICFLAG_SEARCH)
+		cubic_search_reset(ccv);
 }
 
 static void
 cubic_cb_destroy(struct cc_var *ccv)
 {
-	free(ccv->cc_data, M_CUBIC);
+	uma_zfree(cubic_zone, ccv->cc_data);
 }
 
 static int
@@ -256,7 +318,7 @@ cubic_cb_init(struct cc_var *ccv)
 {
 	struct cubic *cubic_data;
 
-	cubic_data = malloc(sizeof(struct cubic), M_CUBIC, M_NOWAIT|M_ZERO);
+	cubic_data = uma_zalloc(cubic_zone, M_NOWAIT | M_ZERO);
 
 	if (cubic_data == NULL)
 		return (ENOMEM);
@@ -267,6 +329,7 @@ cubic_cb_init(struct cc_var *ccv)
 	cubic_data->mean_rtt_ticks = 1;
 
 	ccv->cc_data = cubic_data;
+	cubic_search_params_init(ccv);
 
 	return (0);
 }
@@ -348,9 +411,18 @@ cubic_conn_init(struct cc_var *ccv)
 static int
 cubic_mod_init(void)
 {
+	cubic_zone = uma_zcreate("cubic_search", sizeof(struct cubic), NULL,
+	    NULL, NULL, NULL, UMA_ALIGN_CACHE, 0);
+
 	return (0);
 }
 
+static void
+cubic_mod_destroy(void)
+{
+	uma_zdestroy(cubic_zone);
+}
+
 /*
  * Perform any necessary tasks before we exit congestion recovery.
  */
@@ -481,5 +553,128 @@ cubic_ssthresh_update(struct cc_var *ccv, uint32_t maxseg)
 	CCV(ccv, snd_ssthresh) = max(ssthresh, 2 * maxseg);
 }
 
+/*
+ * Take the SEARCH tunables for the life of the connection, kept within the
+ * ranges of the Linux module sysctls. Bins are resized to follow the RTT
+ * and one bin over the threshold exits, as the Linux defaults do.
+ */
+static void
+cubic_search_params_init(struct cc_var *ccv)
+{
+	struct cubic *cubic_data;
+	struct search_params *p;
+
+	cubic_data = ccv->cc_data;
+	p = &cubic_data->search_params;
+	p->window_size_time = min(max(V_cubic_search_window_size_time, 1),
+	    SEARCH_MAX_WINDOW_SIZE_TIME);
+	p->thresh = min(V_cubic_search_thresh, 100);
+	p->do_intpld = V_cubic_search_do_intpld != 0;
+	p->cwnd_rollback = V_cubic_search_cwnd_rollback ?
+	    SEARCH_ROLLBACK_STEP : SEARCH_ROLLBACK_NONE;
+	p->rebin = 1;
+	p->confirm = 1;
+
+	if (V_cubic_search)
+		cubic_data->flags |= CUBICFLAG_SEARCH;
+}
+
+/*
+ * Restart SEARCH with an empty bin ring. Bin duration is set again from
+ * the first RTT sample that follows.
+ */
+static void
+cubic_search_reset(struct cc_var *ccv)
+{
+	struct cubic *cubic_data;
+
+	cubic_data = ccv->cc_data;
+
+	search_reset(&cubic_data->search);
+	cubic_data->flags &= ~CUBICFLAG_SEARCH_DONE;
+}
+
+/*
+ * The delivered bytes stopped growing with the sending rate: leave slow
+ * start, optionally rolling cwnd back by the bytes delivered over the
+ * last two initial RTTs.
+ */
+static void
+cubic_search_exit_slow_start(struct cc_var *ccv)
+{
+	struct cubic *cubic_data;
+	uint64_t overshoot;
+
+	cubic_data = ccv->cc_data;
+
+	if (cubic_data->search_params.cwnd_rollback != SEARCH_ROLLBACK_NONE) {
+		overshoot = search_overshoot_bytes(&cubic_data->search,
+		    &cubic_data->search_params);
+		CCV(ccv, snd_cwnd) = search_rollback_cwnd(CCV(ccv, snd_cwnd),
+		    overshoot, tcp_compute_initwnd(tcp_maxseg(ccv->ccvc.tcp)));
+	}
+
+	cubic_data->search.stop_search = 1;
+	cubic_data->flags |= CUBICFLAG_SEARCH_DONE;
+	CCV(ccv, snd_ssthresh) = CCV(ccv, snd_cwnd);
+}
+
+/*
+ * Feed the bytes acked so far into the SEARCH core of the Linux module
+ * (src/tcp_search.h), which at each bin boundary compares the bytes
+ * delivered over the last window with those delivered one RTT earlier.
+ */
+static void
+cubic_search_update(struct cc_var *ccv)
+{
+	struct cubic *cubic_data;
+	struct search_sample sample;
+	uint32_t now_us, rtt_us;
+	int ret;
+
+	/* SEARCH needs at least one RTT sample to size its bins. */
+	if (CCV(ccv, t_rttupdated) == 0)
+		return;
+
+	cubic_data = ccv->cc_data;
+	now_us = (uint32_t)sbttous(sbinuptime());
+	rtt_us = max((uint32_t)(((uint64_t)CCV(ccv, t_srtt) * tick) >>
+	    TCP_RTT_SHIFT), 1);
+
+	/*
+	 * Bins filled while the application or the receive window held the
+	 * sender below cwnd say nothing about the path, they are recorded
+	 * but never compared.
+	 */
+	ret = search_process_delivered(&cubic_data->search,
+	    &cubic_data->search_params, now_us, now_us,
+	    cubic_data->search_bytes_acked, rtt_us,
+	    (ccv->flags & CCF_CWND_LIMITED) == 0, &sample);
+
+	if (ret & SEARCH_EXIT)
+		cubic_search_exit_slow_start(ccv);
+}
+
+SYSCTL_DECL(_net_inet_tcp_cc_cubic_search);
+SYSCTL_NODE(_net_inet_tcp_cc, OID_AUTO, cubic_search,
+    CTLFLAG_RW | CTLFLAG_MPSAFE, NULL,
+    "CUBIC with SEARCH slow start related settings");
+
+SYSCTL_UINT(_net_inet_tcp_cc_cubic_search, OID_AUTO, search,
+    CTLFLAG_VNET | CTLFLAG_RW, &VNET_NAME(cubic_search), 0,
+    "Enable SEARCH slow start exit 0: disabled, 1: enabled");
+SYSCTL_UINT(_net_inet_tcp_cc_cubic_search, OID_AUTO, search_window_size_time,
+    CTLFLAG_VNET | CTLFLAG_RW, &VNET_NAME(cubic_search_window_size_time), 0,
+    "Multiply with (initial RTT / 10) to set the window size");
+SYSCTL_UINT(_net_inet_tcp_cc_cubic_search, OID_AUTO, search_thresh,
+    CTLFLAG_VNET | CTLFLAG_RW, &VNET_NAME(cubic_search_thresh), 0,
+    "Threshold for exiting from slow start in percentage");
+SYSCTL_UINT(_net_inet_tcp_cc_cubic_search, OID_AUTO, cwnd_rollback,
+    CTLFLAG_VNET | CTLFLAG_RW, &VNET_NAME(cubic_search_cwnd_rollback), 0,
+    "Decrease the cwnd to its value in 2 initial RTT ago");
+SYSCTL_UINT(_net_inet_tcp_cc_cubic_search, OID_AUTO, do_intpld,
+    CTLFLAG_VNET | CTLFLAG_RW, &VNET_NAME(cubic_search_do_intpld), 0,
+    "Do interpolation for calculating previous delivered bytes window");
+
 DECLARE_CC_MODULE(cubic_search, &cubic_cc_algo);
 MODULE_VERSION(cubic_search, 1);
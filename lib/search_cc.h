@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * SEARCH slow start exit for userspace transports.
+ *
+ * Wraps the SEARCH core of tcp_search.h, its bins, interpolation, exit
+ * test and search_rollback_cwnd(), behind a handful of calls with no
+ * kernel, libc allocation or clock dependency, for the congestion control
+ * callbacks of a QUIC stack. Copy this file and ../src/tcp_search.h next
+ * to each other, or build with -I src. The caller owns struct search_cc,
+ * typically inside its per-path congestion state, and:
+ *
+ *	on creating the path, after an idle restart or a persistent
+ *	congestion (RTO) collapse back to slow start:
+ *		search_cc_init(&cc, NULL);
+ *	on every ACK frame while in slow start:
+ *		if (search_cc_on_ack(&cc, now_us, delivered, rtt_us) & SEARCH_EXIT)
+ *			ssthresh = cwnd = search_cc_exit_cwnd(&cc, cwnd, 2 * mss);
+ *
+ * now_us is any microsecond clock, it may wrap at 32 bits. delivered is
+ * the cumulative count of bytes newly acknowledged on the path, rtt_us the
+ * latest RTT sample. Use search_cc_on_ack_limited() to leave deliveries of
+ * an app-limited sender out of the exit test. Define SEARCH_HAVE_TYPES if
+ * u8, u16, u32, s32 and u64 are already defined.
+ */
+#ifndef _SEARCH_CC_H
+#define _SEARCH_CC_H
+
+#include "tcp_search.h"
+
+#define SEARCH_CC_WINDOW_SIZE_TIME	35	/* tcp_cubic_search.c defaults */
+#define SEARCH_CC_THRESH		35
+
+struct search_cc {
+	struct search_state	state;
+	struct search_params	params;
+};
+
+static const struct search_params search_cc_default_params = {
+	.window_size_time	= SEARCH_CC_WINDOW_SIZE_TIME,
+	.thresh			= SEARCH_CC_THRESH,
+	.do_intpld		= 1,
+	.cwnd_rollback		= SEARCH_ROLLBACK_STEP,
+	.rebin			= 1,
+	.confirm		= 1,
+};
+
+/* Start a new search with @p, or the kernel module's defaults when NULL.
+ * SEARCH_ROLLBACK_DRAIN is not offered here: draining needs the pacing of
+ * the module and is treated as SEARCH_ROLLBACK_STEP.
+ */
+static inline void search_cc_init(struct search_cc *cc, const struct search_params *p)
+{
+	cc->params = p ? *p : search_cc_default_params;
+	if (!cc->params.window_size_time)
+		cc->params.window_size_time = 1;
+	if (cc->params.thresh > 100)
+		cc->params.thresh = 100;
+	search_reset(&cc->state);
+}
+
+/* Whether this search is over, by an exit or search_cc_stop() */
+static inline bool search_cc_done(const struct search_cc *cc)
+{
+	return cc->state.stop_search;
+}
+
+/* Stop searching, when slow start ended for another reason such as a loss */
+static inline void search_cc_stop(struct search_cc *cc)
+{
+	cc->state.stop_search = 1;
+}
+
+/* Feed an ACK, @limited when the application or the peer's flow control
+ * held the sender back since the last one. Returns the search_process()
+ * flags, with SEARCH_EXIT once at the choke point, and 0 after it.
+ */
+static inline int search_cc_on_ack_limited(struct search_cc *cc, u64 now_us,
+					   u64 delivered_bytes, u32 rtt_us, bool limited)
+{
+	struct search_sample sample;
+	int ret;
+
+	if (cc->state.stop_search)
+		return 0;
+
+	ret = search_process_delivered(&cc->state, &cc->params, (u32)now_us, (u32)now_us,
+				       delivered_bytes, rtt_us ? rtt_us : 1, limited,
+				       &sample);
+	if (ret & SEARCH_EXIT)
+		cc->state.stop_search = 1;
+
+	return ret;
+}
+
+static inline int search_cc_on_ack(struct search_cc *cc, u64 now_us,
+				   u64 delivered_bytes, u32 rtt_us)
+{
+	return search_cc_on_ack_limited(cc, now_us, delivered_bytes, rtt_us, false);
+}
+
+/* The cwnd to continue with after SEARCH_EXIT, in bytes: @cwnd_bytes less
+ * what was delivered beyond the choke point, not below @min_cwnd_bytes and
+ * @min_cwnd_bytes when that is all of it, by search_rollback_cwnd().
+ * Only valid until the next search_cc_on_ack*() call.
+ */
+static inline u64 search_cc_exit_cwnd(const struct search_cc *cc, u64 cwnd_bytes,
+				      u64 min_cwnd_bytes)
+{
+	if (cc->params.cwnd_rollback == SEARCH_ROLLBACK_NONE)
+		return cwnd_bytes;
+
+	return search_rollback_cwnd(cwnd_bytes,
+				    search_overshoot_bytes(&cc->state, &cc->params),
+				    min_cwnd_bytes);
+}
+
+#endif /* _SEARCH_CC_H */
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Select bpf_cubicsearch for every TCP socket of a cgroup.
+ *
+ *	bpftool prog load search_sockops.bpf.o /sys/fs/bpf/search_sockops
+ *	bpftool cgroup attach <cgroup> sock_ops pinned /sys/fs/bpf/search_sockops
+ *
+ * Active opens switch before the SYN is sent, listeners switch before
+ * they accept, and accepted sockets inherit the choice of the listener.
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#define SOL_TCP		6
+#define TCP_CONGESTION	13
+
+char _license[] SEC("license") = "GPL";
+
+SEC("sockops")
+int search_sockops(struct bpf_sock_ops *skops)
+{
+	char ca[] = "bpf_cubicsearch";
+
+	switch (skops->op) {
+	case BPF_SOCK_OPS_TCP_CONNECT_CB:
+	case BPF_SOCK_OPS_TCP_LISTEN_CB:
+		bpf_setsockopt(skops, SOL_TCP, TCP_CONGESTION, ca, sizeof(ca));
+		break;
+	default:
+		break;
+	}
+
+	return 1;
+}
@@ -0,0 +1,637 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * TCP CUBIC w/ SEARCH as a BPF struct_ops congestion control.
+ *
+ * The same algorithm as tcp_cubic_search.c, loadable without rebuilding
+ * or rebooting the kernel:
+ *
+ *	bpftool struct_ops register tcp_cubic_search.bpf.o
+ *
+ * registers "bpf_cubicsearch" next to the built-in algorithms. Sockets
+ * pick it with setsockopt(TCP_CONGESTION), through the
+ * net.ipv4.tcp_congestion_control sysctl, or per cgroup through
+ * search_sockops.bpf.c. Existing connections keep the algorithm they
+ * started with.
+ *
+ * SEARCH tunables are taken from the search_config map by every flow when
+ * it is created, so an update applies to new flows only:
+ *
+ *	bpftool map update pinned /sys/fs/bpf/search_config key 0 0 0 0 \
+ *		value <search> <window_size_time> <thresh> <cwnd_rollback> <do_intpld> \
+ *		      <rebin> <confirm>
+ *
+ * with every field as a 4 byte little endian integer. An all zero entry
+ * selects the module defaults, any other is clamped to the ranges of the
+ * module sysctls.
+ *
+ * The private congestion control area of a stock kernel is too small for
+ * the SEARCH bins, so the CUBIC state lives in icsk_ca_priv and the SEARCH
+ * state in socket local storage. HyStart, disabled by default in the
+ * module, is not part of this build.
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#include "../tcp_search.h"
+
+char _license[] SEC("license") = "GPL";
+
+#define BICTCP_BETA_SCALE    1024	/* Scale factor beta calculation
+					 * max_cwnd = snd_cwnd * beta
+					 */
+#define	BICTCP_HZ		10	/* BIC HZ 2^10 = 1024 */
+
+#define TCP_INIT_CWND		10
+#define USEC_PER_SEC		1000000UL
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+extern unsigned long CONFIG_HZ __kconfig;
+#define HZ CONFIG_HZ
+
+/* CUBIC parameters, fixed at the module defaults */
+static const int fast_convergence = 1;
+static const int beta = 717;		/* = 717/1024 (BICTCP_BETA_SCALE) */
+static const int bic_scale = 41;
+static const int tcp_friendliness = 1;
+
+/* Precomputed by cubicsearch_register() in the module */
+#define beta_scale	(8 * (BICTCP_BETA_SCALE + 717) / 3 / (BICTCP_BETA_SCALE - 717))
+#define cube_rtt_scale	(41 * 10)	/* 1024*c/rtt */
+#define cube_factor	((1ull << (10 + 3 * BICTCP_HZ)) / (41 * 10))
+
+/* SEARCH tunables, see the module parameters of the same names. A flow
+ * takes them when it is created, later changes apply to new flows only.
+ */
+struct search_tunables {
+	__u32	search;
+	__u32	window_size_time;
+	__u32	thresh;
+	__u32	cwnd_rollback;
+	__u32	do_intpld;
+	__u32	rebin;
+	__u32	confirm;
+};
+
+static const struct search_tunables search_defaults = {
+	.search			= 1,
+	.window_size_time	= 35,
+	.thresh			= 35,
+	.cwnd_rollback		= 1,
+	.do_intpld		= 1,
+	.rebin			= 1,
+	.confirm		= 1,
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct search_tunables);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} search_config SEC(".maps");
+
+/* Same counters as /proc/net/tcp_search, summed over all namespaces */
+enum {
+	SEARCH_MIB_EXITS,		/* slow start exits found by SEARCH */
+	SEARCH_MIB_EXIT_CWND,		/* sum of snd_cwnd at those exits */
+	SEARCH_MIB_ROLLBACKS,		/* exits that rolled cwnd back */
+	SEARCH_MIB_MISSED_BIN_RESETS,	/* bin history lost to missed bins */
+	SEARCH_MIB_REBINS,		/* bins resized to follow the RTT */
+	__SEARCH_MIB_MAX
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, __SEARCH_MIB_MAX);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(pinning, LIBBPF_PIN_BY_NAME);
+} search_stats SEC(".maps");
+
+/* Per-flow SEARCH, only for the flows created while search was on */
+struct search_sk {
+	struct search_state	search;
+	struct search_params	params;	/* taken by bpf_cubicsearch_init */
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_SK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct search_sk);
+} search_sk_state SEC(".maps");
+
+/* BIC TCP Parameters, named apart from the built-in CUBIC in vmlinux.h */
+struct bpf_bictcp {
+	u32	cnt;		/* increase cwnd by 1 after ACKs */
+	u32	last_max_cwnd;	/* last maximum snd_cwnd */
+	u32	last_cwnd;	/* the last snd_cwnd */
+	u32	last_time;	/* time when updated last_cwnd */
+	u32	bic_origin_point;/* origin point of bic function */
+	u32	bic_K;		/* time to origin point
+				   from the beginning of the current epoch */
+	u32	delay_min;	/* min delay (usec) */
+	u32	epoch_start;	/* beginning of an epoch */
+	u32	ack_cnt;	/* number of acks */
+	u32	tcp_cwnd;	/* estimated tcp cwnd */
+};
+
+extern __u32 tcp_slow_start(struct tcp_sock *tp, __u32 acked) __ksym;
+extern void tcp_cong_avoid_ai(struct tcp_sock *tp, __u32 w, __u32 acked) __ksym;
+extern __u32 tcp_reno_undo_cwnd(struct sock *sk) __ksym;
+
+static __always_inline struct tcp_sock *tcp_sk(const struct sock *sk)
+{
+	return (struct tcp_sock *)sk;
+}
+
+static __always_inline void *inet_csk_ca(const struct sock *sk)
+{
+	return (void *)((const struct inet_connection_sock *)sk)->icsk_ca_priv;
+}
+
+static __always_inline bool before(__u32 seq1, __u32 seq2)
+{
+	return (__s32)(seq1 - seq2) < 0;
+}
+#define after(seq2, seq1)	before(seq1, seq2)
+
+static __always_inline bool tcp_in_slow_start(const struct tcp_sock *tp)
+{
+	return tp->snd_cwnd < tp->snd_ssthresh;
+}
+
+static __always_inline bool tcp_is_cwnd_limited(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	/* If in slow start, ensure cwnd grows to twice what was ACKed. */
+	if (tcp_in_slow_start(tp))
+		return tp->snd_cwnd < 2 * tp->max_packets_out;
+
+	return !!BPF_CORE_READ_BITFIELD(tp, is_cwnd_limited);
+}
+
+static __always_inline bool search_sender_limited(const struct sock *sk)
+{
+	return tcp_sk(sk)->app_limited || !tcp_is_cwnd_limited(sk);
+}
+
+static __always_inline __u32 tcp_jiffies32(void)
+{
+	return bpf_jiffies64();
+}
+
+static __always_inline __u32 usecs_to_jiffies(__u32 usecs)
+{
+	return ((__u64)usecs * HZ + USEC_PER_SEC - 1) / USEC_PER_SEC;
+}
+
+static __always_inline u32 bictcp_clock_us(const struct sock *sk)
+{
+	return tcp_sk(sk)->tcp_mstamp;
+}
+
+static __always_inline int fls64(__u64 x)
+{
+	int num = 63;
+
+	if (!x)
+		return 0;
+
+	if (!(x & (~0ull << 32))) {
+		num -= 32;
+		x <<= 32;
+	}
+	if (!(x & (~0ull << (64 - 16)))) {
+		num -= 16;
+		x <<= 16;
+	}
+	if (!(x & (~0ull << (64 - 8)))) {
+		num -= 8;
+		x <<= 8;
+	}
+	if (!(x & (~0ull << (64 - 4)))) {
+		num -= 4;
+		x <<= 4;
+	}
+	if (!(x & (~0ull << (64 - 2)))) {
+		num -= 2;
+		x <<= 2;
+	}
+	if (!(x & (~0ull << (64 - 1))))
+		num -= 1;
+
+	return num + 1;
+}
+
+static __always_inline const struct search_tunables *search_get_config(void)
+{
+	const struct search_tunables *cfg;
+	__u32 key = 0;
+
+	cfg = bpf_map_lookup_elem(&search_config, &key);
+	/* only an entry never written, a zero window with search off still
+	 * turns SEARCH off
+	 */
+	if (!cfg || !(cfg->search | cfg->window_size_time | cfg->thresh |
+		      cfg->cwnd_rollback | cfg->do_intpld | cfg->rebin | cfg->confirm))
+		return &search_defaults;
+
+	return cfg;
+}
+
+static void search_add_stats(__u32 field, __u64 val)
+{
+	__u64 *cnt = bpf_map_lookup_elem(&search_stats, &field);
+
+	if (cnt)
+		*cnt += val;
+}
+
+static __always_inline void bictcp_reset(struct bpf_bictcp *ca)
+{
+	ca->cnt = 0;
+	ca->last_max_cwnd = 0;
+	ca->last_cwnd = 0;
+	ca->last_time = 0;
+	ca->bic_origin_point = 0;
+	ca->bic_K = 0;
+	ca->delay_min = 0;
+	ca->epoch_start = 0;
+	ca->ack_cnt = 0;
+	ca->tcp_cwnd = 0;
+}
+
+/* The map holds whatever was written to it, keep to the ranges of the
+ * module sysctls
+ */
+static __always_inline void search_params_init(struct search_params *p,
+					       const struct search_tunables *cfg)
+{
+	p->window_size_time = min(max(cfg->window_size_time, 1), SEARCH_MAX_WINDOW_SIZE_TIME);
+	p->thresh = min(cfg->thresh, 100);
+	p->do_intpld = !!cfg->do_intpld;
+	p->cwnd_rollback = min(cfg->cwnd_rollback, SEARCH_ROLLBACK_DRAIN);
+	p->rebin = !!cfg->rebin;
+	p->confirm = min(max(cfg->confirm, 1), SEARCH_MAX_CONFIRM);
+}
+
+static void bictcp_search_reset(struct sock *sk)
+{
+	struct search_sk *ss;
+
+	ss = bpf_sk_storage_get(&search_sk_state, sk, NULL, 0);
+	if (ss)
+		search_reset(&ss->search);
+}
+
+SEC("struct_ops")
+void BPF_PROG(bpf_cubicsearch_init, struct sock *sk)
+{
+	const struct search_tunables *cfg = search_get_config();
+	struct search_sk *ss;
+
+	bictcp_reset(inet_csk_ca(sk));
+
+	if (!cfg->search)
+		return;
+
+	ss = bpf_sk_storage_get(&search_sk_state, sk, NULL,
+				BPF_SK_STORAGE_GET_F_CREATE);
+	if (!ss)
+		return;
+
+	search_params_init(&ss->params, cfg);
+	search_reset(&ss->search);
+}
+
+SEC("struct_ops")
+void BPF_PROG(bpf_cubicsearch_cwnd_event, struct sock *sk, enum tcp_ca_event event)
+{
+	struct bpf_bictcp *ca = inet_csk_ca(sk);
+
+	if (event == CA_EVENT_TX_START) {
+		__u32 now = tcp_jiffies32();
+		__s32 delta;
+
+		delta = now - tcp_sk(sk)->lsndtime;
+
+		/* We were application limited (idle) for a while.
+		 * Shift epoch_start to keep cwnd growth to cubic curve.
+		 */
+		if (ca->epoch_start && delta > 0) {
+			ca->epoch_start += delta;
+			if (after(ca->epoch_start, now))
+				ca->epoch_start = now;
+		}
+	} else if (event == CA_EVENT_CWND_RESTART) {
+		bictcp_search_reset(sk);
+	}
+}
+
+/*
+ * cbrt(x) MSB values for x MSB values in [0..63].
+ * Precomputed then refined by hand - Willy Tarreau
+ *
+ * For x in [0..63],
+ *   v = cbrt(x << 18) - 1
+ *   cbrt(x) = (v[x] + 10) >> 6
+ */
+static const __u8 v[] = {
+	/* 0x00 */    0,   54,   54,   54,  118,  118,  118,  118,
+	/* 0x08 */  123,  129,  134,  138,  143,  147,  151,  156,
+	/* 0x10 */  157,  161,  164,  168,  170,  173,  176,  179,
+	/* 0x18 */  181,  185,  187,  190,  192,  194,  197,  199,
+	/* 0x20 */  200,  202,  204,  206,  209,  211,  213,  215,
+	/* 0x28 */  217,  219,  221,  222,  224,  225,  227,  229,
+	/* 0x30 */  231,  232,  234,  236,  237,  239,  240,  242,
+	/* 0x38 */  244,  245,  246,  248,  250,  251,  252,  254,
+};
+
+/* calculate the cubic root of x using a table lookup followed by one
+ * Newton-Raphson iteration.
+ * Avg err ~= 0.195%
+ */
+static __u32 cubic_root(__u64 a)
+{
+	__u32 x, b, shift;
+
+	if (a < 64) {
+		/* a in [0..63] */
+		return ((__u32)v[(__u32)a] + 35) >> 6;
+	}
+
+	b = fls64(a);
+	b = ((b * 84) >> 8) - 1;
+	shift = (a >> (b * 3));
+
+	/* it is needed for verifier's bound check on v */
+	if (shift >= 64)
+		return 0;
+
+	x = ((__u32)(((__u32)v[shift] + 10) << b)) >> 6;
+
+	/*
+	 * Newton-Raphson iteration
+	 *			 2
+	 * x    = ( 2 * x  +  a / x  ) / 3
+	 *  k+1	  k	 k
+	 */
+	x = (2 * x + (__u32)(a / ((__u64)x * (__u64)(x - 1))));
+	x = ((x * 341) >> 10);
+	return x;
+}
+
+/*
+ * Compute congestion window to use.
+ */
+static void bictcp_update(struct bpf_bictcp *ca, __u32 cwnd, __u32 acked)
+{
+	__u32 delta, bic_target, max_cnt;
+	__u64 offs, t;
+
+	ca->ack_cnt += acked;	/* count the number of ACKed packets */
+
+	if (ca->last_cwnd == cwnd &&
+	    (__s32)(tcp_jiffies32() - ca->last_time) <= HZ / 32)
+		return;
+
+	/* The CUBIC function can update ca->cnt at most once per jiffy.
+	 * On all cwnd reduction events, ca->epoch_start is set to 0,
+	 * which will force a recalculation of ca->cnt.
+	 */
+	if (ca->epoch_start && tcp_jiffies32() == ca->last_time)
+		goto tcp_friendliness;
+
+	ca->last_cwnd = cwnd;
+	ca->last_time = tcp_jiffies32();
+
+	if (ca->epoch_start == 0) {
+		ca->epoch_start = tcp_jiffies32();	/* record beginning */
+		ca->ack_cnt = acked;			/* start counting */
+		ca->tcp_cwnd = cwnd;			/* syn with cubic */
+
+		if (ca->last_max_cwnd <= cwnd) {
+			ca->bic_K = 0;
+			ca->bic_origin_point = cwnd;
+		} else {
+			/* Compute new K based on
+			 * (wmax-cwnd) * (srtt>>3 / HZ) / c * 2^(3*bictcp_HZ)
+			 */
+			ca->bic_K = cubic_root(cube_factor
+					       * (ca->last_max_cwnd - cwnd));
+			ca->bic_origin_point = ca->last_max_cwnd;
+		}
+	}
+
+	/* cubic function - calc*/
+	t = (__s32)(tcp_jiffies32() - ca->epoch_start);
+	t += usecs_to_jiffies(ca->delay_min);
+	/* change the unit from HZ to bictcp_HZ */
+	t <<= BICTCP_HZ;
+	t /= HZ;
+
+	if (t < ca->bic_K)		/* t - K */
+		offs = ca->bic_K - t;
+	else
+		offs = t - ca->bic_K;
+
+	/* c/rtt * (t-K)^3 */
+	delta = (cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
+	if (t < ca->bic_K)			    /* below origin*/
+		bic_target = ca->bic_origin_point - delta;
+	else					  /* above origin*/
+		bic_target = ca->bic_origin_point + delta;
+
+	/* cubic function - calc bictcp_cnt*/
+	if (bic_target > cwnd) {
+		ca->cnt = cwnd / (bic_target - cwnd);
+	} else {
+		ca->cnt = 100 * cwnd;	      /* very small increment*/
+	}
+
+	/*
+	 * The initial growth of cubic function may be too conservative
+	 * when the available bandwidth is still unknown.
+	 */
+	if (ca->last_max_cwnd == 0 && ca->cnt > 20)
+		ca->cnt = 20;	/* increase cwnd 5% per RTT */
+
+tcp_friendliness:
+	/* TCP Friendly */
+	if (tcp_friendliness) {
+		__u32 scale = beta_scale;
+		__u32 n;
+
+		delta = (cwnd * scale) >> 3;
+		if (ca->ack_cnt > delta && delta) {	/* update tcp cwnd */
+			n = ca->ack_cnt / delta;
+			ca->ack_cnt -= n * delta;
+			ca->tcp_cwnd += n;
+		}
+
+		if (ca->tcp_cwnd > cwnd) {	/* if bic is slower than tcp */
+			delta = ca->tcp_cwnd - cwnd;
+			max_cnt = cwnd / delta;
+			if (ca->cnt > max_cnt)
+				ca->cnt = max_cnt;
+		}
+	}
+
+	/* The maximum rate of cwnd increase CUBIC allows is 1 packet per
+	 * 2 packets ACKed, meaning cwnd grows at 1.5x per RTT.
+	 */
+	ca->cnt = max(ca->cnt, 2U);
+}
+
+SEC("struct_ops")
+void BPF_PROG(bpf_cubicsearch_cong_avoid, struct sock *sk, __u32 ack, __u32 acked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bpf_bictcp *ca = inet_csk_ca(sk);
+
+	if (!tcp_is_cwnd_limited(sk))
+		return;
+
+	if (tcp_in_slow_start(tp)) {
+		acked = tcp_slow_start(tp, acked);
+		if (!acked)
+			return;
+	}
+	bictcp_update(ca, tp->snd_cwnd, acked);
+	tcp_cong_avoid_ai(tp, ca->cnt, acked);
+}
+
+SEC("struct_ops")
+__u32 BPF_PROG(bpf_cubicsearch_recalc_ssthresh, struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bpf_bictcp *ca = inet_csk_ca(sk);
+
+	ca->epoch_start = 0;	/* end of epoch */
+
+	/* Wmax and fast convergence */
+	if (tp->snd_cwnd < ca->last_max_cwnd && fast_convergence)
+		ca->last_max_cwnd = (tp->snd_cwnd * (BICTCP_BETA_SCALE + beta))
+			/ (2 * BICTCP_BETA_SCALE);
+	else
+		ca->last_max_cwnd = tp->snd_cwnd;
+
+	return max((tp->snd_cwnd * beta) / BICTCP_BETA_SCALE, 2U);
+}
+
+SEC("struct_ops")
+void BPF_PROG(bpf_cubicsearch_state, struct sock *sk, __u8 new_state)
+{
+	if (new_state == TCP_CA_Loss)
+		bictcp_reset(inet_csk_ca(sk));
+}
+
+SEC("struct_ops")
+__u32 BPF_PROG(bpf_cubicsearch_undo_cwnd, struct sock *sk)
+{
+	return tcp_reno_undo_cwnd(sk);
+}
+
+// Function to handle slow start exit condition
+static void search_exit_slow_start(struct sock *sk, struct search_state *s,
+				   const struct search_params *p)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	search_add_stats(SEARCH_MIB_EXITS, 1);
+	search_add_stats(SEARCH_MIB_EXIT_CWND, tp->snd_cwnd);
+
+	/* no room for the drain state here, SEARCH_ROLLBACK_DRAIN steps too */
+	if (p->cwnd_rollback != SEARCH_ROLLBACK_NONE) {
+		__u32 prior_cwnd = tp->snd_cwnd;
+
+		tp->snd_cwnd = search_rollback_cwnd(tp->snd_cwnd,
+						    search_overshoot_bytes(s, p) / tp->mss_cache,
+						    TCP_INIT_CWND);
+
+		if (tp->snd_cwnd != prior_cwnd)
+			search_add_stats(SEARCH_MIB_ROLLBACKS, 1);
+	}
+
+	s->stop_search = 1;
+	tp->snd_ssthresh = tp->snd_cwnd;
+}
+
+static void search_update(struct sock *sk, struct search_sk *ss, __u32 rtt_us)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct search_state *s = &ss->search;
+	const struct search_params *p = &ss->params;
+	__u32 now_us = bictcp_clock_us(sk);
+	struct search_sample sample;
+	int ret;
+
+	/* as in the module, both an application limited flight and one
+	 * that did not fill cwnd keep the bin out of the comparison
+	 */
+	ret = search_process_delivered(s, p, now_us, now_us, tp->bytes_acked,
+				       rtt_us, search_sender_limited(sk),
+				       &sample);
+
+	if (ret & SEARCH_MISSED_RESET)
+		search_add_stats(SEARCH_MIB_MISSED_BIN_RESETS, 1);
+
+	if (ret & SEARCH_REBIN)
+		search_add_stats(SEARCH_MIB_REBINS, 1);
+
+	if (ret & SEARCH_EXIT)
+		search_exit_slow_start(sk, s, p);
+}
+
+SEC("struct_ops")
+void BPF_PROG(bpf_cubicsearch_acked, struct sock *sk, const struct ack_sample *sample)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bpf_bictcp *ca = inet_csk_ca(sk);
+	struct search_sk *ss;
+	__u32 delay;
+
+	/* Some calls are for duplicates without timetamps */
+	if (sample->rtt_us < 0)
+		return;
+
+	/* Discard delay samples right after fast recovery */
+	if (ca->epoch_start && (__s32)(tcp_jiffies32() - ca->epoch_start) < HZ)
+		return;
+
+	delay = sample->rtt_us;
+	if (delay == 0)
+		delay = 1;
+
+	/* first time call or link delay decreases */
+	if (ca->delay_min == 0 || ca->delay_min > delay)
+		ca->delay_min = delay;
+
+	ss = bpf_sk_storage_get(&search_sk_state, sk, NULL, 0);
+	if (!ss || ss->search.stop_search)
+		return;
+
+	if (!tcp_in_slow_start(tp))
+		ss->search.stop_search = 1;
+	else
+		/* implement search algorithm */
+		search_update(sk, ss, delay);
+}
+
+SEC(".struct_ops")
+struct tcp_congestion_ops cubicsearch = {
+	.init		= (void *)bpf_cubicsearch_init,
+	.ssthresh	= (void *)bpf_cubicsearch_recalc_ssthresh,
+	.cong_avoid	= (void *)bpf_cubicsearch_cong_avoid,
+	.set_state	= (void *)bpf_cubicsearch_state,
+	.undo_cwnd	= (void *)bpf_cubicsearch_undo_cwnd,
+	.cwnd_event	= (void *)bpf_cubicsearch_cwnd_event,
+	.pkts_acked	= (void *)bpf_cubicsearch_acked,
+	.name		= "bpf_cubicsearch",
+};
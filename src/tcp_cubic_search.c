@@ -24,15 +24,50 @@
  * this behaves the same as the original Reno.
  */
 
+#include <linux/atomic.h>
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/math64.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/stringify.h>
+#include <linux/sysctl.h>
+#include <net/ipv6.h>
 #include <net/tcp.h>
+#include <net/netns/generic.h>
+#include "tcp_search.h"
+
+/* Build variants, see SEARCH_VARIANTS in the Makefile. A variant registers
+ * as search_<variant> and search_<variant>_rs, and suffixes its sysctl
+ * directory and /proc entries with _<variant>, so that it loads next to the
+ * default build. SEARCH_HYSTART 0 compiles HyStart out of the ACK path.
+ */
+#ifdef SEARCH_VARIANT
+#define SEARCH_CA_NAME		"search_" __stringify(SEARCH_VARIANT)
+#define SEARCH_ENTRY(name)	name "_" __stringify(SEARCH_VARIANT)
+#else
+#define SEARCH_CA_NAME		"cubic_search"
+#define SEARCH_ENTRY(name)	name
+#endif
+#ifndef SEARCH_HYSTART
+#define SEARCH_HYSTART		1
+#endif
+
+#define CREATE_TRACE_POINTS
+#include "tcp_search_trace.h"
 
 #define BICTCP_BETA_SCALE    1024	/* Scale factor beta calculation
 					 * max_cwnd = snd_cwnd * beta
 					 */
 #define	BICTCP_HZ		10	/* BIC HZ 2^10 = 1024 */
+#define	BICTCP_HZ_US		16	/* time unit 2^-16 s with cubic_us */
+#define	BICTCP_USEC_SCALE	4295	/* 2^32 / USEC_PER_SEC */
 
 /* Two methods of hybrid slow start */
 #define HYSTART_ACK_TRAIN	0x1
@@ -49,8 +84,13 @@ static int beta __read_mostly = 717;	/* = 717/1024 (BICTCP_BETA_SCALE) */
 static int initial_ssthresh __read_mostly;
 static int bic_scale __read_mostly = 41;
 static int tcp_friendliness __read_mostly = 1;
+static int cubic_us __read_mostly;
 
+#if SEARCH_HYSTART
 static int hystart __read_mostly = 0; 	/* Disabled Hystart to use SEARCH */
+#else
+static const int hystart;
+#endif
 static int hystart_detect __read_mostly = HYSTART_ACK_TRAIN | HYSTART_DELAY;
 static int hystart_low_window __read_mostly = 16;
 static int hystart_ack_delta_us __read_mostly = 2000;
@@ -69,8 +109,12 @@ module_param(bic_scale, int, 0444);
 MODULE_PARM_DESC(bic_scale, "scale (scaled by 1024) value for bic function (bic_scale/1024)");
 module_param(tcp_friendliness, int, 0644);
 MODULE_PARM_DESC(tcp_friendliness, "turn on/off tcp friendliness");
+module_param(cubic_us, int, 0644);
+MODULE_PARM_DESC(cubic_us, "run the cubic function of new flows on the microsecond clock instead of jiffies");
+#if SEARCH_HYSTART
 module_param(hystart, int, 0644);
-MODULE_PARM_DESC(hystart, "turn on/off hybrid slow start algorithm");
+MODULE_PARM_DESC(hystart, "turn on/off hybrid slow start algorithm (ignored while SEARCH is enabled, see hystart_policy)");
+#endif
 module_param(hystart_detect, int, 0644);
 MODULE_PARM_DESC(hystart_detect, "hybrid slow start detection mechanisms"
 		 " 1: packet-train 2: delay 3: both packet-train and delay");
@@ -82,33 +126,172 @@ MODULE_PARM_DESC(hystart_ack_delta_us, "spacing between ack's indicating train (
 
 //////////////////////// SEARCH ////////////////////////
 /**
-   disable search with command:
- 		sudo sh -c "echo '0' > /sys/module/cubic_with_search/parameters/search"
-   enable search with command:
- 		sudo sh -c "echo '1' > /sys/module/cubic_with_search/parameters/search"
+   The module parameters below set the initial SEARCH configuration of every
+   network namespace, tune a namespace at runtime with:
+ 		sudo sysctl -w net.ipv4.tcp_search.search=0
+   Each flow keeps the configuration it was created with.
 */
 
-#define SEARCH_BINS 10		/* Number of bins in a window */
-#define SEARCH_TOTAL_BINS 25 	/* Total number of bins containing essential
-				   bins to cover RTT shift */
-
 static int search __read_mostly = 1;
 static int search_window_size_time __read_mostly = 35;
 static int search_thresh __read_mostly = 35;
 static int cwnd_rollback __read_mostly = 1;
 static int do_intpld __read_mostly = 1;
-
-// Module parameters used by SEARCH
-module_param(search, int, 0644);
+static int rebin __read_mostly = 1;
+static int dst_cache_timeout __read_mostly = 60;
+static int rearm __read_mostly;
+static int hystart_policy __read_mostly;
+static int ecn __read_mostly;
+static int group __read_mostly;
+static int confirm __read_mostly = 1;
+static int adapt __read_mostly;
+
+// Module parameters used by SEARCH, defaults of net.ipv4.tcp_search.*
+module_param(search, int, 0444);
 MODULE_PARM_DESC(search, "Enable SEARCH algorithm 0: disabled, 1: enabled");
-module_param(search_window_size_time, int, 0644);
+module_param(search_window_size_time, int, 0444);
 MODULE_PARM_DESC(search_window_size_time, "Multiply with (initial RTT / 10) to set the window size");
-module_param(search_thresh, int, 0644);
+module_param(search_thresh, int, 0444);
 MODULE_PARM_DESC(search_thresh, "Threshold for exiting from slow start in percentage");
-module_param(cwnd_rollback, int, 0644);
-MODULE_PARM_DESC(cwnd_rollback, "Decrease the cwnd to its value in 2 initial RTT ago");
-module_param(do_intpld, int, 0644);
+module_param(cwnd_rollback, int, 0444);
+MODULE_PARM_DESC(cwnd_rollback, "Decrease the cwnd to its value in 2 initial RTT ago"
+		 " 0: disabled, 1: at once, 2: paced drain over one RTT");
+module_param(do_intpld, int, 0444);
 MODULE_PARM_DESC(do_intpld, "Do interpolation for calculating previous delivered bytes window");
+module_param(confirm, int, 0444);
+MODULE_PARM_DESC(confirm, "Bins in a row over search_thresh before slow start is exited (1-7)");
+module_param(rebin, int, 0444);
+MODULE_PARM_DESC(rebin, "Merge or split bins when the RTT drifts away from the first sample");
+module_param(rearm, int, 0444);
+MODULE_PARM_DESC(rearm, "Run SEARCH again whenever slow start restarts after an RTO or idle period");
+module_param(hystart_policy, int, 0444);
+MODULE_PARM_DESC(hystart_policy, "Combine SEARCH with the HyStart delay signal"
+		 " 0: SEARCH alone, 1: either, 2: both, 3: SEARCH unless the delay did not grow");
+module_param(ecn, int, 0444);
+MODULE_PARM_DESC(ecn, "End slow start at the delivery of the last RTT when ECE arrives in a second bin while searching");
+module_param(group, int, 0444);
+MODULE_PARM_DESC(group, "Search the joint delivery of flows starting together to the same destination");
+module_param(dst_cache_timeout, int, 0444);
+MODULE_PARM_DESC(dst_cache_timeout, "Seconds a SEARCH exit point seeds ssthresh of new flows to the same destination, 0: disabled");
+module_param(adapt, int, 0444);
+MODULE_PARM_DESC(adapt, "Tune search_thresh per destination from how its SEARCH exits turned out, kept in the destination cache");
+
+/* How the HyStart delay signal takes part in the SEARCH exit */
+enum {
+	SEARCH_HYSTART_OFF,	/* SEARCH alone */
+	SEARCH_HYSTART_ANY,	/* whichever of the two signals first */
+	SEARCH_HYSTART_BOTH,	/* SEARCH, once the delay signal was seen */
+	SEARCH_HYSTART_VETO,	/* SEARCH, while the delay of this round is up */
+};
+
+/* Per-netns SEARCH counters, reported in /proc/net/tcp_search */
+enum {
+	SEARCH_MIB_EXITS,		/* slow start exits found by SEARCH */
+	SEARCH_MIB_EXIT_CWND,		/* sum of snd_cwnd at those exits */
+	SEARCH_MIB_ROLLBACKS,		/* exits that rolled cwnd back */
+	SEARCH_MIB_MISSED_BIN_RESETS,	/* bin history lost to missed bins */
+	SEARCH_MIB_REBINS,		/* bins resized to follow the RTT */
+	SEARCH_MIB_DST_SEEDS,		/* flows seeded from the destination cache */
+	SEARCH_MIB_DST_STALE,		/* cache entries rejected as too old or a new path */
+	SEARCH_MIB_HYSTART_EXITS,	/* exits on the delay signal, hystart_policy 1 */
+	SEARCH_MIB_HYSTART_VETOES,	/* SEARCH exits held back by the delay signal */
+	SEARCH_MIB_SHIFT_GUARDS,	/* bins not compared, the RTT shift ran past the ring */
+	SEARCH_MIB_ECN_EXITS,		/* slow start exits on ECE, net.ipv4.tcp_search.ecn */
+	SEARCH_MIB_LIMITED,		/* bins not compared, the sender limited the windows */
+	SEARCH_MIB_GROUP_JOINS,		/* flows searching with a group, net.ipv4.tcp_search.group */
+	SEARCH_MIB_GROUP_EXITS,		/* groups that found the choke point */
+	SEARCH_MIB_GROUP_VETOES,	/* exits of a member held back until its group's */
+	SEARCH_MIB_UNCONFIRMED,		/* bins over search_thresh short of confirm in a row */
+	SEARCH_MIB_ADAPT_DOWN,		/* exits followed by a loss, the destination's thresh lowered */
+	SEARCH_MIB_ADAPT_UP,		/* exits followed by a rising delivery rate, thresh raised */
+	__SEARCH_MIB_MAX
+};
+
+static const char * const search_mib_names[__SEARCH_MIB_MAX] = {
+	[SEARCH_MIB_EXITS]		= "SearchExits",
+	[SEARCH_MIB_EXIT_CWND]		= "SearchExitCwnd",
+	[SEARCH_MIB_ROLLBACKS]		= "SearchRollbacks",
+	[SEARCH_MIB_MISSED_BIN_RESETS]	= "SearchMissedBinResets",
+	[SEARCH_MIB_REBINS]		= "SearchRebins",
+	[SEARCH_MIB_DST_SEEDS]		= "SearchDstCacheSeeds",
+	[SEARCH_MIB_DST_STALE]		= "SearchDstCacheStale",
+	[SEARCH_MIB_HYSTART_EXITS]	= "SearchHystartExits",
+	[SEARCH_MIB_HYSTART_VETOES]	= "SearchHystartVetoes",
+	[SEARCH_MIB_SHIFT_GUARDS]	= "SearchShiftGuards",
+	[SEARCH_MIB_ECN_EXITS]		= "SearchEcnExits",
+	[SEARCH_MIB_LIMITED]		= "SearchLimitedBins",
+	[SEARCH_MIB_GROUP_JOINS]	= "SearchGroupJoins",
+	[SEARCH_MIB_GROUP_EXITS]	= "SearchGroupExits",
+	[SEARCH_MIB_GROUP_VETOES]	= "SearchGroupVetoes",
+	[SEARCH_MIB_UNCONFIRMED]	= "SearchUnconfirmed",
+	[SEARCH_MIB_ADAPT_DOWN]		= "SearchAdaptDown",
+	[SEARCH_MIB_ADAPT_UP]		= "SearchAdaptUp",
+};
+
+struct search_mib {
+	unsigned long	mibs[__SEARCH_MIB_MAX];
+};
+
+/* Per-netns log2 histograms of SEARCH exits, reported in
+ * /proc/net/tcp_search_stats. Bucket i counts values in [2^(i-1), 2^i),
+ * bucket 0 counts zeros.
+ */
+#define SEARCH_HIST_BUCKETS	32
+
+enum {
+	SEARCH_HIST_EXIT_CWND,		/* snd_cwnd at the exit, before rollback */
+	SEARCH_HIST_EXIT_RTTS,		/* time from the first ACK to the exit, in min RTTs */
+	SEARCH_HIST_EXIT_BINS,		/* bins closed until the exit */
+	SEARCH_HIST_ROLLBACK,		/* packets taken off cwnd by the rollback */
+	SEARCH_HIST_RTT_SHIFT,		/* RTT shift in whole bins of every closed bin */
+	__SEARCH_HIST_MAX
+};
+
+static const char * const search_hist_names[__SEARCH_HIST_MAX] = {
+	[SEARCH_HIST_EXIT_CWND]		= "ExitCwnd",
+	[SEARCH_HIST_EXIT_RTTS]		= "ExitRtts",
+	[SEARCH_HIST_EXIT_BINS]		= "ExitBins",
+	[SEARCH_HIST_ROLLBACK]		= "RollbackCwnd",
+	[SEARCH_HIST_RTT_SHIFT]		= "RttShiftBins",
+};
+
+struct search_hist {
+	unsigned long	buckets[__SEARCH_HIST_MAX][SEARCH_HIST_BUCKETS];
+};
+
+/* Per-netns SEARCH state: counters and the net.ipv4.tcp_search sysctls */
+struct search_net {
+	struct search_mib __percpu *mib;
+	struct search_hist __percpu *hist;
+	struct ctl_table_header *sysctl_hdr;
+	int	search;
+	int	window_size_time;
+	int	thresh;
+	int	cwnd_rollback;
+	int	do_intpld;
+	int	rebin;
+	int	rearm;
+	int	dst_cache_timeout;	/* jiffies, 0 disables the destination cache */
+	int	hystart_policy;
+	int	ecn;
+	int	group;
+	int	confirm;
+	int	adapt;
+};
+
+static unsigned int search_net_id __read_mostly;
+
+#define SEARCH_ADD_STATS(net, field, val)	\
+	this_cpu_add(((struct search_net *)net_generic(net, search_net_id))->mib->mibs[field], val)
+#define SEARCH_INC_STATS(net, field)	SEARCH_ADD_STATS(net, field, 1)
+
+/* Only touches this CPU's copy, they are folded when the file is read */
+static inline void search_hist_add(const struct net *net, int hist, u32 val)
+{
+	const struct search_net *sn = net_generic(net, search_net_id);
+
+	this_cpu_inc(sn->hist->buckets[hist][min_t(u32, fls(val), SEARCH_HIST_BUCKETS - 1)]);
+}
 
 /* BIC TCP Parameters */
 struct bictcp {
@@ -123,34 +306,479 @@ struct bictcp {
 	u32	epoch_start;	/* beginning of an epoch */
 	u32	ack_cnt;	/* number of acks */
 	u32	tcp_cwnd;	/* estimated tcp cwnd */
-	u16	unused;
-	u8	sample_cnt;	/* number of samples to decide curr_rtt */
-	u8	found;		/* the exit point is found? */
-	u32	round_start;	/* beginning of each round */
-	u32	end_seq;	/* end_seq of the round */
-	u32	last_ack;	/* last time when the ACK spacing is close */
-	u32	curr_rtt;	/* the minimum rtt of current round */
 
-	//////////////////////// SEARCH ////////////////////////
-	u32	bin[SEARCH_TOTAL_BINS]; 	/* array to keep bytes for bins */
-	u32	bin_duration_us; 		/* duration of each bin in microsecond */
-	u32	bin_total; 			/* total number of bins */
-	u32	bin_end_us; 			/* end time of the latest bin in microsecond */
-	u8	stop_search; 			/* the choke/exit point based on SEARCH is found */
-	u64	prev_bytes_acked;		/* previous total bytes acked */
-	////////////////////////////////////////////////////////
+	/* Paced drain toward the rollback target after a SEARCH exit */
+	u32	drain_cwnd;	/* cwnd at the exit, 0 while not draining */
+	union {
+		struct {
+			u32	drain_target;	/* cwnd at the end of the drain */
+			u32	drain_acc;	/* acked packets times the drained amount, mod drain_cwnd */
+		};
+		/* HyStart delay signal next to SEARCH, only before the exit */
+		struct {
+			u32	curr_rtt;	/* the minimum rtt of current round */
+			u32	end_seq;	/* end_seq of the round */
+		} hybrid;
+	};
+
+	/* SEARCH configuration of the netns when the flow was created */
+	u8	search_mode:2,	/* net.ipv4.tcp_search.search */
+		search_group:1,	/* member of the destination's search_group */
+		search_adapt:1,	/* the outcome of the exit is pending, see search_outcome */
+		group_limited:1,/* sender limited since group_pkts were last added */
+		ecn_bin:1,	/* ECE seen in the open bin, see search_ecn_exit */
+		ecn_prev:1;	/* ECE seen in a bin already closed */
+	struct search_params search_params;
+	u8	search_rs:1,	/* SEARCH fed from rate samples, see cubic_search_rs */
+		search_rearm:1,	/* net.ipv4.tcp_search.rearm */
+		hybrid_policy:2,/* net.ipv4.tcp_search.hystart_policy */
+		hybrid_found:1,	/* the delay signal was seen in this slow start */
+		search_ecn:1,	/* net.ipv4.tcp_search.ecn */
+		ecn_ece:1,	/* the ACK being processed carries ECE */
+		cubic_us:1;	/* epoch_start and last_time are in usec, not jiffies */
+	u8	hybrid_samples;	/* delay samples in this round */
+	u16	group_pkts;	/* delivered, not yet added to the search_group */
+
+	/* HyStart and SEARCH never run on the same flow, so their
+	 * per-flow state shares the same space
+	 */
+	union {
+		/* HyStart variables */
+		struct {
+			u16	unused;
+			u8	sample_cnt;	/* number of samples to decide curr_rtt */
+			u8	found;		/* the exit point is found? */
+			u32	round_start;	/* beginning of each round */
+			u32	end_seq;	/* end_seq of the round */
+			u32	last_ack;	/* last time when the ACK spacing is close */
+			u32	curr_rtt;	/* the minimum rtt of current round */
+		} hystart;
+
+		//////////////////////// SEARCH ////////////////////////
+		struct search_state search;
+		////////////////////////////////////////////////////////
+	};
 };
 
+static inline void search_hystart_reset(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	ca->hybrid.end_seq = tcp_sk(sk)->snd_nxt;
+	ca->hybrid.curr_rtt = ~0U;
+	ca->hybrid_samples = 0;
+	ca->hybrid_found = 0;
+}
+
 static inline void bictcp_search_reset(struct sock *sk)
 {
-	const struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
-	memset(ca->bin, 0, sizeof(ca->bin));
-	ca->bin_duration_us = 0;
-	ca->bin_total = 0;
-	ca->bin_end_us = 0;
-	ca->stop_search = 0;
-	ca->prev_bytes_acked = tp->bytes_acked;
+
+	search_reset(&ca->search);
+	search_hystart_reset(sk);
+	ca->search_group = 0;
+	ca->search_adapt = 0;
+	ca->ecn_bin = 0;
+	ca->ecn_prev = 0;
+}
+
+/* Take the SEARCH configuration of the netns, later sysctl writes only
+ * affect new flows
+ */
+static void bictcp_search_snapshot(struct sock *sk)
+{
+	const struct search_net *sn = net_generic(sock_net(sk), search_net_id);
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	ca->search_mode = READ_ONCE(sn->search);
+	ca->search_params.window_size_time = READ_ONCE(sn->window_size_time);
+	ca->search_params.thresh = READ_ONCE(sn->thresh);
+	ca->search_params.do_intpld = READ_ONCE(sn->do_intpld);
+	ca->search_params.cwnd_rollback = READ_ONCE(sn->cwnd_rollback);
+	ca->search_params.rebin = READ_ONCE(sn->rebin);
+	ca->search_params.confirm = READ_ONCE(sn->confirm);
+	ca->search_rearm = READ_ONCE(sn->rearm);
+	ca->hybrid_policy = SEARCH_HYSTART ? READ_ONCE(sn->hystart_policy) : 0;
+	ca->search_ecn = READ_ONCE(sn->ecn);
+}
+
+/* Per-destination cache of SEARCH exit points.
+ *
+ * cwnd found by SEARCH (after rollback) is kept with the min RTT it was
+ * measured at. New flows to the same destination in the same netns start
+ * with that cwnd as ssthresh, so slow start already stops there if SEARCH
+ * does not exit earlier. An entry seeds nothing once it is older than
+ * net.ipv4.tcp_search.dst_cache_timeout or when the handshake RTT says the
+ * path changed, then the flow relies on SEARCH alone.
+ *
+ * With net.ipv4.tcp_search.adapt the entry also carries the search_thresh
+ * tuned for the destination, which seeded flows search with.
+ *
+ * The table is direct-mapped: a new exit point replaces whatever entry
+ * shares its slot. Readers only take rcu_read_lock(); exits are rare enough
+ * for one lock to serialize the writers.
+ */
+#define SEARCH_DST_CACHE_BITS	10
+#define SEARCH_DST_RTT_TOLERANCE 25	/* percent of the cached min RTT */
+#define SEARCH_ADAPT_THRESH_MIN	10	/* bounds of the tuned search_thresh, percent */
+#define SEARCH_ADAPT_THRESH_MAX	60
+
+struct search_dst {
+	struct rcu_head	rcu;
+	const struct net *net;
+	struct in6_addr	addr;		/* IPv4 destinations are v4-mapped */
+	u32		cwnd;		/* cwnd after the SEARCH exit, in packets */
+	u32		min_rtt_us;	/* ca->delay_min at the exit */
+	unsigned long	stamp;		/* jiffies at the exit */
+	u8		thresh;		/* search_thresh of the flow, then tuned by its outcome */
+};
+
+static struct search_dst __rcu *search_dst_cache[1 << SEARCH_DST_CACHE_BITS];
+static DEFINE_SPINLOCK(search_dst_lock);
+
+static bool search_dst_key(const struct sock *sk, struct in6_addr *addr)
+{
+	switch (sk->sk_family) {
+	case AF_INET:
+		ipv6_addr_set_v4mapped(sk->sk_daddr, addr);
+		return true;
+#if IS_ENABLED(CONFIG_IPV6)
+	case AF_INET6:
+		*addr = sk->sk_v6_daddr;
+		return true;
+#endif
+	}
+	return false;
+}
+
+static u32 search_dst_slot(const struct net *net, const struct in6_addr *addr)
+{
+	return hash_32(jhash2(addr->s6_addr32, ARRAY_SIZE(addr->s6_addr32),
+			      net_hash_mix(net)), SEARCH_DST_CACHE_BITS);
+}
+
+/* Same path if the RTT is within SEARCH_DST_RTT_TOLERANCE of the cached one */
+static bool search_dst_same_path(const struct search_dst *d, u32 rtt_us)
+{
+	u64 lo = (u64)d->min_rtt_us * (100 - SEARCH_DST_RTT_TOLERANCE);
+	u64 hi = (u64)d->min_rtt_us * (100 + SEARCH_DST_RTT_TOLERANCE);
+
+	return (u64)rtt_us * 100 >= lo && (u64)rtt_us * 100 <= hi;
+}
+
+/* Seed ssthresh of a new flow from a fresh exit point to its destination */
+static void search_dst_seed(struct sock *sk)
+{
+	struct net *net = sock_net(sk);
+	const struct search_net *sn = net_generic(net, search_net_id);
+	int timeout = READ_ONCE(sn->dst_cache_timeout);
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	const struct search_dst *d;
+	struct in6_addr addr;
+	/* the handshake RTT, CC is initialized once the connection is up */
+	u32 rtt_us = tp->srtt_us >> 3;
+
+	if (!timeout || !rtt_us || !search_dst_key(sk, &addr))
+		return;
+
+	rcu_read_lock();
+	d = rcu_dereference(search_dst_cache[search_dst_slot(net, &addr)]);
+	if (!d || d->net != net || !ipv6_addr_equal(&d->addr, &addr))
+		goto out;
+
+	if (time_after(jiffies, d->stamp + timeout) ||
+	    !search_dst_same_path(d, rtt_us)) {
+		SEARCH_INC_STATS(net, SEARCH_MIB_DST_STALE);
+		goto out;
+	}
+
+	if (d->cwnd < tp->snd_ssthresh) {
+		tp->snd_ssthresh = min(d->cwnd, tp->snd_cwnd_clamp);
+		SEARCH_INC_STATS(net, SEARCH_MIB_DST_SEEDS);
+	}
+	if (READ_ONCE(sn->adapt))
+		ca->search_params.thresh = READ_ONCE(d->thresh);
+out:
+	rcu_read_unlock();
+}
+
+/* Remember the exit point @cwnd of this flow for later flows to its destination */
+static void search_dst_store(struct sock *sk, u32 cwnd)
+{
+	struct net *net = sock_net(sk);
+	const struct search_net *sn = net_generic(net, search_net_id);
+	const struct bictcp *ca = inet_csk_ca(sk);
+	struct search_dst *d, *old;
+	struct in6_addr addr;
+	u32 slot;
+
+	if (!READ_ONCE(sn->dst_cache_timeout) || !ca->delay_min ||
+	    !search_dst_key(sk, &addr))
+		return;
+
+	d = kmalloc(sizeof(*d), GFP_ATOMIC);
+	if (!d)
+		return;
+
+	d->net = net;
+	d->addr = addr;
+	d->cwnd = cwnd;
+	d->min_rtt_us = ca->delay_min;
+	d->stamp = jiffies;
+	d->thresh = ca->search_params.thresh;
+
+	slot = search_dst_slot(net, &addr);
+	spin_lock_bh(&search_dst_lock);
+	old = rcu_replace_pointer(search_dst_cache[slot], d,
+				  lockdep_is_held(&search_dst_lock));
+	spin_unlock_bh(&search_dst_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+/* Move the tuned search_thresh of the flow's destination by @step. Entries
+ * are only replaced under the lock, two flows tuning the same one at once
+ * may lose a step. Returns whether the entry was still there.
+ */
+static bool search_dst_tune(struct sock *sk, int step)
+{
+	struct net *net = sock_net(sk);
+	struct search_dst *d;
+	struct in6_addr addr;
+	bool tuned = false;
+
+	if (!search_dst_key(sk, &addr))
+		return false;
+
+	rcu_read_lock();
+	d = rcu_dereference(search_dst_cache[search_dst_slot(net, &addr)]);
+	if (d && d->net == net && ipv6_addr_equal(&d->addr, &addr)) {
+		WRITE_ONCE(d->thresh, clamp(READ_ONCE(d->thresh) + step,
+					    SEARCH_ADAPT_THRESH_MIN, SEARCH_ADAPT_THRESH_MAX));
+		tuned = true;
+	}
+	rcu_read_unlock();
+
+	return tuned;
+}
+
+/* Drop the entries of a netns going away */
+static void search_dst_flush(const struct net *net)
+{
+	struct search_dst *d;
+	int i;
+
+	spin_lock_bh(&search_dst_lock);
+	for (i = 0; i < ARRAY_SIZE(search_dst_cache); i++) {
+		d = rcu_dereference_protected(search_dst_cache[i],
+					      lockdep_is_held(&search_dst_lock));
+		if (d && d->net == net) {
+			RCU_INIT_POINTER(search_dst_cache[i], NULL);
+			kfree_rcu(d, rcu);
+		}
+	}
+	spin_unlock_bh(&search_dst_lock);
+}
+
+/* Joint SEARCH of parallel flows to the same destination.
+ *
+ * Flows that start within SEARCH_GROUP_IDLE of each other to the same
+ * destination in the same netns join one group. Every member adds what
+ * its ACKs delivered to the group's count as it closes its own bins, and
+ * whichever member is first past the group's bin boundary then closes the
+ * group's, so SEARCH runs on the
+ * joint delivery curve, which flattens when the flows together fill the
+ * bottleneck rather than when one flow's share stops growing. A member
+ * then ends slow start at the next bin it closes itself, rolling back by
+ * its own bins, and its own SEARCH exits wait for the group's.
+ *
+ * A group of one searches what the flow does. Flows that start after the
+ * group exited, that collide with another destination's live group, or
+ * that restart slow start search alone. The table is laid out as the
+ * destination cache.
+ */
+#define SEARCH_GROUP_IDLE	HZ	/* a group with no bin closed for this long is over */
+
+struct search_group {
+	struct rcu_head	rcu;
+	const struct net *net;
+	struct in6_addr	addr;
+	atomic64_t	delivered;	/* bytes delivered to all members */
+	bool		limited;	/* a member was sender limited in the open bin */
+	bool		exited;		/* the choke point was found */
+	unsigned long	stamp;		/* jiffies at the last bin closed */
+	spinlock_t	lock;		/* the member closing a bin */
+	struct search_params params;	/* of the first member */
+	struct search_state search;
+};
+
+static struct search_group __rcu *search_group_table[1 << SEARCH_DST_CACHE_BITS];
+static DEFINE_SPINLOCK(search_group_lock);
+
+static bool search_group_idle(const struct search_group *g)
+{
+	return time_after(jiffies, READ_ONCE(g->stamp) + SEARCH_GROUP_IDLE);
+}
+
+/* Join the searching group of the destination, or start one */
+static void search_group_join(struct sock *sk)
+{
+	struct net *net = sock_net(sk);
+	const struct search_net *sn = net_generic(net, search_net_id);
+	struct bictcp *ca = inet_csk_ca(sk);
+	struct search_group *g, *old;
+	struct in6_addr addr;
+	u32 slot;
+
+	if (!READ_ONCE(sn->group) || !search_dst_key(sk, &addr))
+		return;
+
+	ca->group_pkts = 0;
+	ca->group_limited = 0;
+	slot = search_dst_slot(net, &addr);
+	spin_lock_bh(&search_group_lock);
+	old = rcu_dereference_protected(search_group_table[slot],
+					lockdep_is_held(&search_group_lock));
+	if (old && !search_group_idle(old)) {
+		if (old->net == net && ipv6_addr_equal(&old->addr, &addr) &&
+		    !READ_ONCE(old->exited)) {
+			ca->search_group = 1;
+			SEARCH_INC_STATS(net, SEARCH_MIB_GROUP_JOINS);
+		}
+		goto out;
+	}
+
+	g = kzalloc(sizeof(*g), GFP_ATOMIC);
+	if (!g)
+		goto out;
+
+	g->net = net;
+	g->addr = addr;
+	g->stamp = jiffies;
+	spin_lock_init(&g->lock);
+	g->params = ca->search_params;
+	search_reset(&g->search);
+	rcu_assign_pointer(search_group_table[slot], g);
+	ca->search_group = 1;
+	SEARCH_INC_STATS(net, SEARCH_MIB_GROUP_JOINS);
+	if (old)
+		kfree_rcu(old, rcu);
+out:
+	spin_unlock_bh(&search_group_lock);
+}
+
+/* Count @acked_pkts delivered at @now_us toward the flow's group. They
+ * are kept in the flow, and only when the flow closes one of its own bins
+ * are they added to the group, whose bin is closed too if it is due, so
+ * the members share no cache line on every ACK. Returns whether the group
+ * found the choke point, which search_group_judge() only asks when the
+ * flow closes a bin. A flow whose group was replaced leaves it and
+ * searches alone.
+ */
+static bool search_group_update(struct sock *sk, u32 acked_pkts, u32 now_us,
+				u32 rtt_us, bool limited)
+{
+	struct net *net = sock_net(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	struct search_sample sample;
+	struct search_group *g;
+	struct in6_addr addr;
+	bool exited = false;
+	u64 delivered;
+	u32 pkts;
+
+	if (limited)
+		ca->group_limited = 1;
+
+	pkts = ca->group_pkts + acked_pkts;
+	if (ca->search.bin_duration_us &&
+	    (s32)(now_us - ca->search.bin_end_us) <= 0 && pkts <= U16_MAX) {
+		ca->group_pkts = pkts;
+		return false;
+	}
+
+	limited = ca->group_limited;
+	ca->group_pkts = 0;
+	ca->group_limited = 0;
+
+	if (!search_dst_key(sk, &addr))
+		return false;
+
+	rcu_read_lock();
+	g = rcu_dereference(search_group_table[search_dst_slot(net, &addr)]);
+	if (!g || g->net != net || !ipv6_addr_equal(&g->addr, &addr)) {
+		ca->search_group = 0;
+		goto out;
+	}
+
+	delivered = atomic64_add_return((u64)pkts * tcp_sk(sk)->mss_cache,
+					&g->delivered);
+	if (limited && !READ_ONCE(g->limited))
+		WRITE_ONCE(g->limited, true);
+
+	/* only one member closes a bin, the others carry on */
+	if (!READ_ONCE(g->exited) &&
+	    (!READ_ONCE(g->search.bin_duration_us) ||
+	     (s32)(now_us - READ_ONCE(g->search.bin_end_us)) > 0) &&
+	    spin_trylock(&g->lock)) {
+		limited = READ_ONCE(g->limited);
+		WRITE_ONCE(g->limited, false);
+		if (!g->exited &&
+		    search_process_delivered(&g->search, &g->params, now_us, now_us,
+					     delivered, rtt_us, limited,
+					     &sample) & SEARCH_EXIT) {
+			WRITE_ONCE(g->exited, true);
+			SEARCH_INC_STATS(net, SEARCH_MIB_GROUP_EXITS);
+		}
+		WRITE_ONCE(g->stamp, jiffies);
+		spin_unlock(&g->lock);
+	}
+	exited = READ_ONCE(g->exited);
+out:
+	rcu_read_unlock();
+	return exited;
+}
+
+/* A member exits with its group: at the first bin it closes once the
+ * group has exited, and not before on its own share of the delivery
+ */
+static int search_group_judge(struct sock *sk, int ret, bool exited)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	if (!ca->search_group || !(ret & SEARCH_BIN_CLOSED))
+		return ret;
+
+	if (exited && !(ret & SEARCH_EXIT)) {
+		search_prev_bin(&ca->search);
+		ret |= SEARCH_EXIT;
+	} else if (!exited && (ret & SEARCH_EXIT)) {
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_GROUP_VETOES);
+		search_next_bin(&ca->search);
+		ret &= ~SEARCH_EXIT;
+	}
+
+	return ret;
+}
+
+/* Drop the groups of a netns going away */
+static void search_group_flush(const struct net *net)
+{
+	struct search_group *g;
+	int i;
+
+	spin_lock_bh(&search_group_lock);
+	for (i = 0; i < ARRAY_SIZE(search_group_table); i++) {
+		g = rcu_dereference_protected(search_group_table[i],
+					      lockdep_is_held(&search_group_lock));
+		if (g && g->net == net) {
+			RCU_INIT_POINTER(search_group_table[i], NULL);
+			kfree_rcu(g, rcu);
+		}
+	}
+	spin_unlock_bh(&search_group_lock);
 }
 
 static inline void bictcp_reset(struct bictcp *ca)
@@ -165,7 +793,9 @@ static inline void bictcp_reset(struct bictcp *ca)
 	ca->epoch_start = 0;
 	ca->ack_cnt = 0;
 	ca->tcp_cwnd = 0;
-	ca->found = 0;
+	ca->drain_cwnd = 0;
+	if (!ca->search_mode)
+		ca->hystart.found = 0;
 
 }
 
@@ -174,15 +804,67 @@ static inline u32 bictcp_clock_us(const struct sock *sk)
 	return tcp_sk(sk)->tcp_mstamp;
 }
 
+/* Clock of the cubic epoch, jiffies or usec with cubic_us */
+static inline u32 bictcp_epoch_now(const struct sock *sk)
+{
+	const struct bictcp *ca = inet_csk_ca(sk);
+
+	return ca->cubic_us ? bictcp_clock_us(sk) : tcp_jiffies32;
+}
+
+static inline u32 bictcp_epoch_hz(const struct bictcp *ca)
+{
+	return ca->cubic_us ? USEC_PER_SEC : HZ;
+}
+
 static inline void bictcp_hystart_reset(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
-	ca->round_start = ca->last_ack = bictcp_clock_us(sk);
-	ca->end_seq = tp->snd_nxt;
-	ca->curr_rtt = ~0U;
-	ca->sample_cnt = 0;
+	ca->hystart.round_start = ca->hystart.last_ack = bictcp_clock_us(sk);
+	ca->hystart.end_seq = tp->snd_nxt;
+	ca->hystart.curr_rtt = ~0U;
+	ca->hystart.sample_cnt = 0;
+}
+
+/* Cumulative bytes delivered as counted by the SEARCH engine of @sk. The
+ * rate sample engine adds the SACKed bytes to the cumulatively acked ones
+ * rather than scaling tp->delivered by the MSS: the u32 packet count wraps
+ * every couple of minutes at 400Gbps, the byte counts do not. The sum
+ * drops when an RTO or reneging clears sacked_out: search_process_delivered()
+ * holds it at the last closed bin, and a search starts from bytes_acked
+ * alone so it never falls below the start.
+ */
+static u64 search_delivered_bytes(const struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct bictcp *ca = inet_csk_ca(sk);
+
+	if (ca->search_rs)
+		return tp->bytes_acked + (u64)tp->sacked_out * tp->mss_cache;
+	return tp->bytes_acked;
+}
+
+/* Slow start restarts after an RTO or an idle period, run SEARCH on it
+ * with bins sized from the current min RTT rather than from whatever
+ * RTT the first ACK of the connection saw
+ */
+static void bictcp_search_rearm(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 min_rtt_us = tcp_min_rtt(tcp_sk(sk));
+
+	ca->drain_cwnd = 0;
+	search_reset(&ca->search);
+	search_hystart_reset(sk);
+	ca->search_group = 0;
+	ca->search_adapt = 0;
+	ca->ecn_bin = 0;
+	ca->ecn_prev = 0;
+	if (min_rtt_us != ~0U)
+		search_start(&ca->search, &ca->search_params, bictcp_clock_us(sk),
+			     min_rtt_us, tcp_sk(sk)->bytes_acked);
 }
 
 
@@ -190,16 +872,22 @@ static void bictcp_init(struct sock *sk)
 {
 	struct bictcp *ca = inet_csk_ca(sk);
 
+	bictcp_search_snapshot(sk);
+	ca->cubic_us = !!READ_ONCE(cubic_us);
 	bictcp_reset(ca);
 
-	if (hystart)
-		bictcp_hystart_reset(sk);
-
-	if (search)
+	if (ca->search_mode)
 		bictcp_search_reset(sk);
+	else if (hystart)
+		bictcp_hystart_reset(sk);
 
 	if (!hystart && initial_ssthresh)
 		tcp_sk(sk)->snd_ssthresh = initial_ssthresh;
+
+	if (ca->search_mode) {
+		search_dst_seed(sk);
+		search_group_join(sk);
+	}
 }
 
 static void bictcp_cwnd_event(struct sock *sk, enum tcp_ca_event event)
@@ -209,8 +897,10 @@ static void bictcp_cwnd_event(struct sock *sk, enum tcp_ca_event event)
 	switch(event) {
 	case CA_EVENT_TX_START:
 		s32 delta;
-		u32 now = tcp_jiffies32;
-		delta = now - tcp_sk(sk)->lsndtime;
+		u32 now = bictcp_epoch_now(sk);
+		delta = tcp_jiffies32 - tcp_sk(sk)->lsndtime;
+		if (ca->cubic_us)
+			delta = jiffies_to_usecs(delta);
 
 		/* We were application limited (idle) for a while.
 		 * Shift epoch_start to keep cwnd growth to cubic curve.
@@ -222,7 +912,10 @@ static void bictcp_cwnd_event(struct sock *sk, enum tcp_ca_event event)
 		}
 		break;
 	case CA_EVENT_CWND_RESTART:
-		if (search)
+		ca->drain_cwnd = 0;
+		if (ca->search_mode && ca->search_rearm)
+			bictcp_search_rearm(sk);
+		else if (ca->search_mode)
 			bictcp_search_reset(sk);
 		break;
 	default:
@@ -279,32 +972,45 @@ static u32 cubic_root(u64 a)
 	return x;
 }
 
+/* c/rtt * offs^3 with offs in 2^-16 s, for cubic_us. offs is capped at
+ * 2^24 (256 s), far past any plateau, and cubed in steps so that nothing
+ * overflows 64 bits.
+ */
+static inline u32 bictcp_cube_us(u64 offs)
+{
+	offs = min_t(u64, offs, 1ULL << 24);
+
+	return (cube_rtt_scale * ((((offs * offs) >> 16) * offs) >> 16)) >>
+	       (10 + 3 * BICTCP_HZ_US - 32);
+}
+
 /*
  * Compute congestion window to use.
  */
-static inline void bictcp_update(struct bictcp *ca, u32 cwnd, u32 acked)
+static inline void bictcp_update(struct bictcp *ca, u32 now, u32 cwnd, u32 acked)
 {
 	u32 delta, bic_target, max_cnt;
-	u64 offs, t;
+	u64 offs, t, k;
 
 	ca->ack_cnt += acked;	/* count the number of ACKed packets */
 
 	if (ca->last_cwnd == cwnd &&
-	    (s32)(tcp_jiffies32 - ca->last_time) <= HZ / 32)
+	    (s32)(now - ca->last_time) <= bictcp_epoch_hz(ca) / 32)
 		return;
 
-	/* The CUBIC function can update ca->cnt at most once per jiffy.
+	/* The CUBIC function can update ca->cnt at most once per jiffy,
+	 * or usec with cubic_us.
 	 * On all cwnd reduction events, ca->epoch_start is set to 0,
 	 * which will force a recalculation of ca->cnt.
 	 */
-	if (ca->epoch_start && tcp_jiffies32 == ca->last_time)
+	if (ca->epoch_start && now == ca->last_time)
 		goto tcp_friendliness;
 
 	ca->last_cwnd = cwnd;
-	ca->last_time = tcp_jiffies32;
+	ca->last_time = now;
 
 	if (ca->epoch_start == 0) {
-		ca->epoch_start = tcp_jiffies32;	/* record beginning */
+		ca->epoch_start = now;	/* record beginning */
 		ca->ack_cnt = acked;			/* start counting */
 		ca->tcp_cwnd = cwnd;			/* syn with cubic */
 
@@ -335,20 +1041,31 @@ static inline void bictcp_update(struct bictcp *ca, u32 cwnd, u32 acked)
 	 * if the cwnd < 1 million packets !!!
 	 */
 
-	t = (s32)(tcp_jiffies32 - ca->epoch_start);
-	t += usecs_to_jiffies(ca->delay_min);
-	/* change the unit from HZ to bictcp_HZ */
-	t <<= BICTCP_HZ;
-	do_div(t, HZ);
+	if (ca->cubic_us) {
+		/* the same curve in 2^-16 s, K stays in bictcp_HZ */
+		t = (u64)(now - ca->epoch_start) + ca->delay_min;
+		t = (t * BICTCP_USEC_SCALE) >> (32 - BICTCP_HZ_US);
+		k = (u64)ca->bic_K << (BICTCP_HZ_US - BICTCP_HZ);
+	} else {
+		t = (s32)(now - ca->epoch_start);
+		t += usecs_to_jiffies(ca->delay_min);
+		/* change the unit from HZ to bictcp_HZ */
+		t <<= BICTCP_HZ;
+		do_div(t, HZ);
+		k = ca->bic_K;
+	}
 
-	if (t < ca->bic_K)		/* t - K */
-		offs = ca->bic_K - t;
+	if (t < k)		/* t - K */
+		offs = k - t;
 	else
-		offs = t - ca->bic_K;
+		offs = t - k;
 
 	/* c/rtt * (t-K)^3 */
-	delta = (cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
-	if (t < ca->bic_K)			    /* below origin*/
+	if (ca->cubic_us)
+		delta = bictcp_cube_us(offs);
+	else
+		delta = (cube_rtt_scale * offs * offs * offs) >> (10+3*BICTCP_HZ);
+	if (t < k)			    /* below origin*/
 		bic_target = ca->bic_origin_point - delta;
 	else					  /* above origin*/
 		bic_target = ca->bic_origin_point + delta;
@@ -397,25 +1114,165 @@ static void bictcp_cong_avoid(struct sock *sk, u32 ack, u32 acked)
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
+	/* cwnd is on its way down to the SEARCH rollback target */
+	if (ca->drain_cwnd)
+		return;
+
 	if (!tcp_is_cwnd_limited(sk))
 		return;
 
 	if (tcp_in_slow_start(tp)) {
 
-		if (hystart && after(ack, ca->end_seq))
+		if (hystart && !ca->search_mode && after(ack, ca->hystart.end_seq))
 			bictcp_hystart_reset(sk);
 		acked = tcp_slow_start(tp, acked);
 		if (!acked)
 			return;
 	}
-	bictcp_update(ca, tp->snd_cwnd, acked);
+	bictcp_update(ca, bictcp_epoch_now(sk), tp->snd_cwnd, acked);
 	tcp_cong_avoid_ai(tp, ca->cnt, acked);
 }
 
+/* Outcome of a SEARCH exit, net.ipv4.tcp_search.adapt.
+ *
+ * For SEARCH_ADAPT_RTTS min RTTs after the exit the flow watches what
+ * happens. A retransmission means the exit came too late, and the
+ * destination's search_thresh goes down by SEARCH_ADAPT_STEP. A delivery
+ * rate that beat the one of the last RTT before the exit by
+ * SEARCH_ADAPT_GAIN percent means the exit came too early, and search_thresh
+ * goes up. Anything in between leaves it alone, so the threshold settles
+ * per destination between SEARCH_ADAPT_THRESH_MIN and _MAX.
+ *
+ * The bins are free after the exit, the outcome is kept in them, next to
+ * the rate of a paced drain.
+ */
+#define SEARCH_ADAPT_RTTS	4
+#define SEARCH_ADAPT_STEP	5	/* percent */
+#define SEARCH_ADAPT_GAIN	20	/* percent */
+
+struct search_outcome {
+	u32	stamp_us;	/* bictcp_clock_us() at the exit */
+	u32	delivered;	/* tp->delivered at the exit */
+	u32	retrans;	/* tp->total_retrans at the exit */
+	u32	rtt_pkts;	/* packets delivered over the last min RTT before the exit */
+};
+
+/* What is left of a flow's search after the exit, see search_exited() */
+struct search_exited {
+	struct search_outcome outcome;
+	u32	drain_rate;	/* bytes per msec while draining, 0: pace by cwnd */
+};
+
+static inline struct search_exited *search_exited(struct bictcp *ca)
+{
+	BUILD_BUG_ON(sizeof(struct search_exited) > sizeof(ca->search.bin));
+	BUILD_BUG_ON(offsetof(struct search_state, bin) % __alignof__(struct search_exited));
+
+	return (struct search_exited *)ca->search.bin;
+}
+
+static inline struct search_outcome *search_outcome(struct bictcp *ca)
+{
+	return &search_exited(ca)->outcome;
+}
+
+/* Start watching the exit that just happened, after its rollback.
+ * @rtt_bytes is what the bins saw delivered over the last min RTT up to
+ * the bin that exited, taken before the rollback reused the bins.
+ */
+static void search_adapt_arm(struct sock *sk, u64 rtt_bytes)
+{
+	const struct search_net *sn = net_generic(sock_net(sk), search_net_id);
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	struct search_outcome *o;
+	u32 rtt_pkts;
+
+	if (!READ_ONCE(sn->adapt) || !READ_ONCE(sn->dst_cache_timeout) || !ca->delay_min)
+		return;
+
+	rtt_pkts = div_u64(rtt_bytes, tp->mss_cache);
+	if (!rtt_pkts)
+		return;
+
+	o = search_outcome(ca);
+	o->stamp_us = bictcp_clock_us(sk);
+	o->delivered = tp->delivered;
+	o->retrans = tp->total_retrans;
+	o->rtt_pkts = rtt_pkts;
+	ca->search_adapt = 1;
+}
+
+/* Score the exit, @lost when loss recovery started */
+static void search_adapt_judge(struct sock *sk, bool lost)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	const struct search_outcome *o = search_outcome(ca);
+	u32 elapsed_us = bictcp_clock_us(sk) - o->stamp_us;
+
+	ca->search_adapt = 0;
+
+	if (lost || tp->total_retrans != o->retrans) {
+		if (search_dst_tune(sk, -SEARCH_ADAPT_STEP))
+			SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_ADAPT_DOWN);
+	} else if ((u64)(tp->delivered - o->delivered) * ca->delay_min * 100 >
+		   (u64)o->rtt_pkts * elapsed_us * (100 + SEARCH_ADAPT_GAIN)) {
+		if (search_dst_tune(sk, SEARCH_ADAPT_STEP))
+			SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_ADAPT_UP);
+	}
+}
+
+/* On every ACK while the outcome is pending */
+static void search_adapt_update(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	if ((s32)(bictcp_clock_us(sk) - search_outcome(ca)->stamp_us) >=
+	    (s32)(SEARCH_ADAPT_RTTS * ca->delay_min))
+		search_adapt_judge(sk, false);
+}
+
+/* ECE while SEARCH is still looking means the queue at the choke point
+ * already passed the marking threshold. Rather than the multiplicative
+ * decrease from the overshoot, ssthresh becomes what the bins saw
+ * delivered over one min RTT, never above @ssthresh. Returns @ssthresh
+ * while there are not enough bins for that.
+ * A single mark may come from a burst through a shallow marking queue, so
+ * the first one only holds cwnd for the CWR round and slow start goes on.
+ * A mark in a later bin ends it.
+ */
+static u32 search_ecn_exit(struct sock *sk, u32 ssthresh)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 bdp;
+
+	if (!ca->ecn_prev) {
+		ca->ecn_bin = 1;
+		return TCP_INFINITE_SSTHRESH;
+	}
+
+	bdp = div_u64(search_delivered_rtt(&ca->search, ca->delay_min), tp->mss_cache);
+	if (!bdp)
+		return ssthresh;
+
+	ssthresh = clamp(bdp, 2U, ssthresh);
+	/* the curve plateaus at the BDP, not at the overshoot */
+	ca->last_max_cwnd = bdp;
+	ca->search.stop_search = 1;
+	SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_ECN_EXITS);
+	search_hist_add(sock_net(sk), SEARCH_HIST_EXIT_CWND, tp->snd_cwnd);
+	search_dst_store(sk, ssthresh);
+
+	return ssthresh;
+}
+
 static u32 bictcp_recalc_ssthresh(struct sock *sk)
 {
 	const struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
+	u32 ssthresh;
 
 	ca->epoch_start = 0;	/* end of epoch */
 
@@ -426,14 +1283,44 @@ static u32 bictcp_recalc_ssthresh(struct sock *sk)
 	else
 		ca->last_max_cwnd = tp->snd_cwnd;
 
-	return max((tp->snd_cwnd * beta) / BICTCP_BETA_SCALE, 2U);
+	ssthresh = max((tp->snd_cwnd * beta) / BICTCP_BETA_SCALE, 2U);
+
+	/* tcp_enter_cwr() on the ACK bictcp_in_ack_event() just saw */
+	if (ca->ecn_ece && ca->search_ecn && ca->search_mode &&
+	    !ca->search.stop_search && tcp_in_slow_start(tp))
+		return search_ecn_exit(sk, ssthresh);
+
+	return ssthresh;
+}
+
+static void bictcp_in_ack_event(struct sock *sk, u32 flags)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	ca->ecn_ece = !!(flags & CA_ACK_ECE);
 }
 
 static void bictcp_state(struct sock *sk, u8 new_state)
 {
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	/* CWR, Recovery and Loss own cwnd from here, Disorder leaves it to
+	 * us and the drain carries on
+	 */
+	if (new_state == TCP_CA_CWR || new_state == TCP_CA_Recovery ||
+	    new_state == TCP_CA_Loss)
+		ca->drain_cwnd = 0;
+
+	if (ca->search_adapt &&
+	    (new_state == TCP_CA_Recovery || new_state == TCP_CA_Loss))
+		search_adapt_judge(sk, true);
+
 	if (new_state == TCP_CA_Loss) {
-		bictcp_reset(inet_csk_ca(sk));
-		bictcp_hystart_reset(sk);
+		bictcp_reset(ca);
+		if (ca->search_mode && ca->search_rearm)
+			bictcp_search_rearm(sk);
+		else if (!ca->search_mode)
+			bictcp_hystart_reset(sk);
 	}
 }
 
@@ -467,8 +1354,8 @@ static void hystart_update(struct sock *sk, u32 delay)
 		u32 now = bictcp_clock_us(sk);
 
 		/* first detection parameter - ack-train detection */
-		if ((s32)(now - ca->last_ack) <= hystart_ack_delta_us) {
-			ca->last_ack = now;
+		if ((s32)(now - ca->hystart.last_ack) <= hystart_ack_delta_us) {
+			ca->hystart.last_ack = now;
 
 			threshold = ca->delay_min + hystart_ack_delay(sk);
 
@@ -480,10 +1367,10 @@ static void hystart_update(struct sock *sk, u32 delay)
 			if (sk->sk_pacing_status == SK_PACING_NONE)
 				threshold >>= 1;
 
-			if ((s32)(now - ca->round_start) > threshold) {
-				ca->found = 1;
+			if ((s32)(now - ca->hystart.round_start) > threshold) {
+				ca->hystart.found = 1;
 				pr_debug("hystart_ack_train (%u > %u) delay_min %u (+ ack_delay %u) cwnd %u\n",
-					 now - ca->round_start, threshold,
+					 now - ca->hystart.round_start, threshold,
 					 ca->delay_min, hystart_ack_delay(sk), tp->snd_cwnd);
 				NET_INC_STATS(sock_net(sk),
 					      LINUX_MIB_TCPHYSTARTTRAINDETECT);
@@ -497,14 +1384,14 @@ static void hystart_update(struct sock *sk, u32 delay)
 
 	if (hystart_detect & HYSTART_DELAY) {
 		/* obtain the minimum delay of more than sampling packets */
-		if (ca->curr_rtt > delay)
-			ca->curr_rtt = delay;
-		if (ca->sample_cnt < HYSTART_MIN_SAMPLES) {
-			ca->sample_cnt++;
+		if (ca->hystart.curr_rtt > delay)
+			ca->hystart.curr_rtt = delay;
+		if (ca->hystart.sample_cnt < HYSTART_MIN_SAMPLES) {
+			ca->hystart.sample_cnt++;
 		} else {
-			if (ca->curr_rtt > ca->delay_min +
+			if (ca->hystart.curr_rtt > ca->delay_min +
 			    HYSTART_DELAY_THRESH(ca->delay_min >> 3)) {
-				ca->found = 1;
+				ca->hystart.found = 1;
 				NET_INC_STATS(sock_net(sk),
 					      LINUX_MIB_TCPHYSTARTDELAYDETECT);
 				NET_ADD_STATS(sock_net(sk),
@@ -516,165 +1403,310 @@ static void hystart_update(struct sock *sk, u32 delay)
 	}
 }
 
-// function to update missed bins
-static void search_update_missed_bins(struct sock *sk)
+/* The delay part of hystart_update() for net.ipv4.tcp_search.hystart_policy:
+ * the minimum RTT of each round, once it has enough samples, against
+ * delay_min. The ACK train is left to SEARCH, which measures the same
+ * delivery rate without HyStart's ack spacing heuristics.
+ */
+static bool search_hystart_delayed(const struct bictcp *ca)
 {
+	return ca->hybrid_samples >= HYSTART_MIN_SAMPLES &&
+	       ca->hybrid.curr_rtt > ca->delay_min +
+				     HYSTART_DELAY_THRESH(ca->delay_min >> 3);
+}
+
+static void search_hystart_update(struct sock *sk, u32 delay)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
-	s32 missed_bin = 0;
-	u32 now_us = bictcp_clock_us(sk);
+	if (after(tp->snd_una, ca->hybrid.end_seq)) {
+		ca->hybrid.end_seq = tp->snd_nxt;
+		ca->hybrid.curr_rtt = ~0U;
+		ca->hybrid_samples = 0;
+	}
 
-	missed_bin = (now_us - ca->bin_end_us) / ca->bin_duration_us;
+	if (ca->hybrid.curr_rtt > delay)
+		ca->hybrid.curr_rtt = delay;
+	if (ca->hybrid_samples < HYSTART_MIN_SAMPLES)
+		ca->hybrid_samples++;
 
-	if (missed_bin > 0) {
-		ca->bin_total += missed_bin;
-		ca->bin_end_us += missed_bin * ca->bin_duration_us;
+	if (!search_hystart_delayed(ca))
+		return;
 
-		if (missed_bin >= SEARCH_TOTAL_BINS)
-		    memset(ca->bin, 0, sizeof(ca->bin));
+	ca->hybrid_found = 1;
+	if (ca->hybrid_policy != SEARCH_HYSTART_ANY ||
+	    tp->snd_cwnd < hystart_low_window)
+		return;
 
-		else {
-			while(missed_bin >= 0){
-				ca->bin[(ca->bin_total - missed_bin) % SEARCH_TOTAL_BINS] = 0;
-				missed_bin--;
-			}
-		}
+	/* the delay signal came first, SEARCH stops with it */
+	ca->search.stop_search = 1;
+	tp->snd_ssthresh = tp->snd_cwnd;
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPHYSTARTDELAYDETECT);
+	NET_ADD_STATS(sock_net(sk), LINUX_MIB_TCPHYSTARTDELAYCWND, tp->snd_cwnd);
+	SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_HYSTART_EXITS);
+}
+
+/* Whether the delay signal lets a SEARCH exit through */
+static bool search_hystart_confirm(const struct bictcp *ca)
+{
+	switch (ca->hybrid_policy) {
+	case SEARCH_HYSTART_BOTH:
+		return ca->hybrid_found;
+	case SEARCH_HYSTART_VETO:
+		return search_hystart_delayed(ca);
+	default:
+		return true;
 	}
 }
 
-// Function to calculate delivered bytes for a window considering additional logic
-static inline u64 search_calculate_window_bytes(struct sock *sk, u32 index)
+/* Instead of dropping cwnd to the rollback target at once, lower cwnd by
+ * the overshoot over about one RTT worth of ACKs, paced at the rate
+ * delivered over the last window. The queue built during the overshoot
+ * then drains without an idle gap followed by a burst.
+ *
+ * Only cubic_search_rs paces at that rate: bictcp_update_pacing_rate()
+ * hands it out from cong_control while drain_cwnd is set. Without
+ * cong_control, TCP derives sk_pacing_rate from cwnd and srtt after every
+ * ACK, so cubic_search only paces by the decreasing cwnd.
+ */
+static void search_drain_start(struct sock *sk, const struct search_params *p,
+			       const struct search_sample *sample)
 {
+	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
+	u32 target = search_rollback_cwnd(tp->snd_cwnd,
+					  div_u64(search_overshoot_bytes(&ca->search, p),
+						  tp->mss_cache),
+					  TCP_INIT_CWND);
 
-	u32 i;
-	u64 delivered_bytes = 0;
-
-	for (i = index - SEARCH_BINS + 1; i <= index; i++)
-		delivered_bytes += ca->bin[i % SEARCH_TOTAL_BINS];
+	if (target >= tp->snd_cwnd)
+		return;
 
-	return delivered_bytes;
+	/* bytes per msec over the SEARCH_BINS bins of the current window,
+	 * read after the overshoot as it reuses the bins
+	 */
+	search_exited(ca)->drain_rate =
+		min_t(u64, mul_u64_u64_div_u64(sample->curr_delv_bytes, USEC_PER_MSEC,
+					       (u64)SEARCH_BINS * ca->search.bin_duration_us),
+		      U32_MAX);
+
+	ca->drain_cwnd = tp->snd_cwnd;
+	ca->drain_target = target;
+	ca->drain_acc = 0;
+
+	trace_tcp_search_rollback(sk, tp->snd_cwnd, target);
+	SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_ROLLBACKS);
+	search_hist_add(sock_net(sk), SEARCH_HIST_ROLLBACK, tp->snd_cwnd - target);
 }
 
-// Function to handle slow start exit condition
-static void search_exit_slow_start(struct sock *sk, u32 rtt_us)
+/* One RTT acks about drain_cwnd packets, so every acked packet takes
+ * (drain_cwnd - drain_target) / drain_cwnd packets off cwnd
+ */
+static void search_drain(struct sock *sk, u32 acked)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
+	u64 acc;
+	u32 dec;
 
-	u64 difference_bytes_acked = 0;
-	u32 i = 0;
-	u32 congestion_index = 0;
-	u32 initial_rtt = 0;
-
-	if (cwnd_rollback == 1) {
-		u32 rollback_cwnd = tp->snd_cwnd;
-
-		initial_rtt = ca->bin_duration_us * SEARCH_BINS * 10 / search_window_size_time;
-		congestion_index = ca->bin_total - ((2 * initial_rtt) / ca->bin_duration_us);
-
-		if (ca->bin_total - congestion_index > SEARCH_TOTAL_BINS)
-			congestion_index = ca->bin_total - SEARCH_TOTAL_BINS + 1;
-
-		for (i = congestion_index + 1 ; i <= ca->bin_total; i++)
-			difference_bytes_acked += ca->bin[i % SEARCH_TOTAL_BINS];
-
-		rollback_cwnd = difference_bytes_acked / tp->mss_cache;
-
-		if (rollback_cwnd < tp->snd_cwnd)
-			tp->snd_cwnd = max(TCP_INIT_CWND, tp->snd_cwnd - rollback_cwnd);
+	acc = ca->drain_acc + (u64)acked * (ca->drain_cwnd - ca->drain_target);
+	if (acc < ca->drain_cwnd) {
+		ca->drain_acc = acc;
+		return;
 	}
 
-	ca->stop_search = 1;
-	tp->snd_ssthresh = tp->snd_cwnd;
+	dec = div_u64_rem(acc, ca->drain_cwnd, &ca->drain_acc);
+	if (tp->snd_cwnd > ca->drain_target + dec) {
+		tp->snd_cwnd -= dec;
+		return;
+	}
 
+	/* done, bictcp_update() takes over from the target */
+	tp->snd_cwnd = min(tp->snd_cwnd, ca->drain_target);
+	ca->drain_cwnd = 0;
 }
 
-// Function to perform interpolation and return the interpolated value
-static u64 search_interpolate_delivered_bytes(struct sock *sk, u32 rtt_us, u32 curr_index, u32 prev_index, u64 left_bytes, u64 right_bytes) {
-
+/* Hand the capacity found by SEARCH over to CUBIC: the rate of the window
+ * that ended slow start times the min RTT becomes W_max, so the next epoch
+ * starts on the concave side of the curve with its plateau at the BDP
+ * instead of creeping up from cwnd as if nothing was known. bictcp_update()
+ * derives bic_K and bic_origin_point from it when the epoch starts.
+ */
+static void search_seed_cubic(struct sock *sk, const struct search_sample *sample)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
-	u32 now_us = bictcp_clock_us(sk);
-	u32 time_left = 0, time_right = 0;
-	u64 interpolated_delv_bytes = 0;
-	u32 proportion = 0;
+	u64 bdp_bytes;
+
+	if (!ca->delay_min || !sample->curr_delv_bytes)
+		return;
 
-	time_right = ca->bin_end_us - ((curr_index - prev_index) * ca->bin_duration_us);
-	time_left = time_right - ca->bin_duration_us;
+	bdp_bytes = mul_u64_u64_div_u64(sample->curr_delv_bytes, ca->delay_min,
+					(u64)SEARCH_BINS * ca->search.bin_duration_us);
+	ca->last_max_cwnd = clamp_t(u64, div_u64(bdp_bytes, tp->mss_cache), 2U,
+				    tp->snd_cwnd_clamp);
+	ca->epoch_start = 0;
+}
 
-	// Check if the time difference for interpolation is non-zero to avoid division by zero
-	if (right_bytes != left_bytes) {
-		// Perform interpolation
-		proportion = ((now_us - rtt_us) - time_left) / ca->bin_duration_us;
-		interpolated_delv_bytes = left_bytes + proportion * (right_bytes - left_bytes);
+// Function to handle slow start exit condition
+static void search_exit_slow_start(struct sock *sk, const struct search_params *p,
+				   const struct search_sample *sample)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	/* bin_total is the bin that exited, not an open one */
+	u64 rtt_bytes = search_delivered_rtt_at(&ca->search, ca->search.bin_total,
+						ca->delay_min);
+
+	trace_tcp_search_exit(sk, sample, tp->snd_cwnd);
+	SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_EXITS);
+	SEARCH_ADD_STATS(sock_net(sk), SEARCH_MIB_EXIT_CWND, tp->snd_cwnd);
+	search_hist_add(sock_net(sk), SEARCH_HIST_EXIT_CWND, tp->snd_cwnd);
+	search_hist_add(sock_net(sk), SEARCH_HIST_EXIT_BINS, sample->bin_total);
+	if (ca->delay_min)
+		search_hist_add(sock_net(sk), SEARCH_HIST_EXIT_RTTS,
+				div_u64((u64)sample->bin_total * ca->search.bin_duration_us,
+					ca->delay_min));
+
+	if (p->cwnd_rollback == SEARCH_ROLLBACK_STEP) {
+		u32 prior_cwnd = tp->snd_cwnd;
+
+		tp->snd_cwnd = search_rollback_cwnd(tp->snd_cwnd,
+						    div_u64(search_overshoot_bytes(&ca->search, p),
+							    tp->mss_cache),
+						    TCP_INIT_CWND);
+
+		if (tp->snd_cwnd != prior_cwnd) {
+			trace_tcp_search_rollback(sk, prior_cwnd, tp->snd_cwnd);
+			SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_ROLLBACKS);
+			search_hist_add(sock_net(sk), SEARCH_HIST_ROLLBACK,
+					prior_cwnd - tp->snd_cwnd);
+		}
+	} else if (p->cwnd_rollback == SEARCH_ROLLBACK_DRAIN) {
+		search_drain_start(sk, p, sample);
 	}
 
-	return interpolated_delv_bytes;
+	ca->search.stop_search = 1;
+	tp->snd_ssthresh = ca->drain_cwnd ? ca->drain_target : tp->snd_cwnd;
+	search_seed_cubic(sk, sample);
+
+	search_dst_store(sk, tp->snd_ssthresh);
+	search_adapt_arm(sk, rtt_bytes);
 }
 
 //////////////////////// SEARCH ////////////////////////
-static void search_update(struct sock *sk, u32 rtt_us)
+static void search_handle(struct sock *sk, int ret, const struct search_sample *sample,
+			  u32 rtt_us)
 {
-
-	struct tcp_sock *tp = tcp_sk(sk);
 	struct bictcp *ca = inet_csk_ca(sk);
 
-	u64 acked_bytes = 0;
-	u32 curr_index = 0;
-	s32 prev_index = 0;
-	u64 curr_delv_bytes = 0, prev_delv_bytes = 0;
-	u64 prev_delv_bytes_under = 0,  prev_delv_bytes_over = 0;
-	s32 norm_diff = 0;
-	u32 now_us = bictcp_clock_us(sk);
+	trace_tcp_search_bin(sk, &ca->search, sample, rtt_us);
+	search_hist_add(sock_net(sk), SEARCH_HIST_RTT_SHIFT, sample->rtt_shift);
 
-	/* by receiving the first ack packet, initialize bin duration and bin end time */
-	if (ca->bin_duration_us == 0) {
-		ca->bin_duration_us = (rtt_us * search_window_size_time) / (SEARCH_BINS * 10);
-		ca->bin_end_us = now_us + ca->bin_duration_us;
-	}
+	ca->ecn_prev |= ca->ecn_bin;
+	ca->ecn_bin = 0;
 
-	/* check if it's reached the bin boundary */
-	if (now_us > ca->bin_end_us) {
-		/* Check and update missed bins */
-		search_update_missed_bins(sk);
+	if (ret & SEARCH_SHIFT_GUARD)
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_SHIFT_GUARDS);
 
-		/* update delivered bytes in bin */
-		acked_bytes = tp->bytes_acked - ca->prev_bytes_acked;
-		ca->bin[ca->bin_total % SEARCH_TOTAL_BINS] = acked_bytes;
-		ca->prev_bytes_acked = tp->bytes_acked;
+	if (ret & SEARCH_LIMITED)
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_LIMITED);
 
-		/* calculate indices for the current window and previous window after shifting by current RTT */
-		curr_index = ca->bin_total;
-		prev_index = ca->bin_total - (rtt_us/ca->bin_duration_us);
+	if (ret & SEARCH_UNCONFIRMED)
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_UNCONFIRMED);
 
-		/* check if there is enough bins after shift for computing previous window */
-		if (prev_index >= SEARCH_BINS && SEARCH_TOTAL_BINS - (curr_index - prev_index) >= SEARCH_BINS) {
+	if (ret & SEARCH_MISSED_RESET)
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_MISSED_BIN_RESETS);
 
-			/* Calculate delivered bytes for the current and previous windows */
-			curr_delv_bytes = search_calculate_window_bytes(sk, curr_index);
-			prev_delv_bytes_over = search_calculate_window_bytes(sk, prev_index);
-			prev_delv_bytes_under = search_calculate_window_bytes(sk, prev_index - 1);
+	if (ret & SEARCH_REBIN)
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_REBINS);
 
-			if (do_intpld == 1)
-				prev_delv_bytes = search_interpolate_delivered_bytes(sk, rtt_us, curr_index, prev_index, prev_delv_bytes_under, prev_delv_bytes_over);
-			else
-				prev_delv_bytes = prev_delv_bytes_over;
+	if (!(ret & SEARCH_EXIT))
+		return;
 
+	/* an RTT that has not grown says the drop in delivery was noise,
+	 * look again at the next bin
+	 */
+	if (SEARCH_HYSTART && !search_hystart_confirm(ca)) {
+		SEARCH_INC_STATS(sock_net(sk), SEARCH_MIB_HYSTART_VETOES);
+		search_next_bin(&ca->search);
+		return;
+	}
 
-			if (prev_delv_bytes > 0) {
-				norm_diff = ((2 * prev_delv_bytes) - curr_delv_bytes)*100 / (2 * prev_delv_bytes);
+	search_exit_slow_start(sk, &ca->search_params, sample);
+}
 
-				/* check for exit condition */
-				if ((2 * prev_delv_bytes) >= curr_delv_bytes && norm_diff >= search_thresh)
-					search_exit_slow_start(sk, rtt_us);
-			}
-		}
+/* The application or the receive window, not the path, holds the sender
+ * back: bins filled now say nothing about the choke point
+ */
+static bool search_sender_limited(const struct sock *sk)
+{
+	return tcp_sk(sk)->app_limited || !tcp_is_cwnd_limited(sk);
+}
 
-		/* update bin-related parameters for the next bin */
-		ca->bin_end_us = ca->bin_end_us + ca->bin_duration_us;
-		ca->bin_total++;
-		ca->bin[ca->bin_total % SEARCH_TOTAL_BINS] = 0;
-	}
+static void search_update(struct sock *sk, u32 rtt_us, u32 pkts_acked)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+	const struct search_params *p = &ca->search_params;
+	u32 now_us = bictcp_clock_us(sk);
+	bool limited = search_sender_limited(sk);
+	struct search_sample sample;
+	bool group_exited = false;
+	int ret;
+
+	if (ca->search_group)
+		group_exited = search_group_update(sk, pkts_acked, now_us, rtt_us,
+						   limited);
+
+	ret = search_process_delivered(&ca->search, p, now_us, now_us,
+				       search_delivered_bytes(sk), rtt_us,
+				       limited, &sample);
+	ret = search_group_judge(sk, ret, group_exited);
+	if (ret)
+		search_handle(sk, ret, &sample, rtt_us);
+}
+
+/* Rate sample engine: bytes are counted as search_delivered_bytes() and every
+ * ACK's share is spread back in time at the delivery rate of the sample,
+ * so a stretch ACK after GRO/LRO or ACK compression fills the bins it
+ * was delivered in instead of the one it arrived in.
+ */
+static void search_update_rs(struct sock *sk, const struct rate_sample *rs)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	u32 now_us = tp->delivered_mstamp;
+	u32 rtt_us = rs->rtt_us > 0 ? rs->rtt_us : tp->srtt_us >> 3;
+	bool limited = rs->is_app_limited || search_sender_limited(sk);
+	u32 span_us = 0;
+	struct search_sample sample;
+	bool group_exited = false;
+	int ret;
+
+	if (!rtt_us)
+		return;
+
+	/* only a bin that closes looks at when its bytes were delivered */
+	if ((s32)(now_us - ca->search.bin_end_us) > 0 &&
+	    rs->interval_us > 0 && rs->delivered > 0 && rs->acked_sacked > 0)
+		span_us = div_u64((u64)min_t(u32, rs->acked_sacked, rs->delivered) *
+				  rs->interval_us, rs->delivered);
+
+	if (ca->search_group && rs->acked_sacked > 0)
+		group_exited = search_group_update(sk, rs->acked_sacked, now_us,
+						   rtt_us, limited);
+
+	if (!ca->search.bin_duration_us)
+		search_start(&ca->search, &ca->search_params, now_us, rtt_us,
+			     tp->bytes_acked);
+	ret = search_process_delivered(&ca->search, &ca->search_params,
+				       now_us - span_us, now_us,
+				       search_delivered_bytes(sk), rtt_us,
+				       limited, &sample);
+	ret = search_group_judge(sk, ret, group_exited);
+	if (ret)
+		search_handle(sk, ret, &sample, rtt_us);
 }
 //////////////////////////////////////////////////////////////
 
@@ -684,12 +1716,16 @@ static void bictcp_acked(struct sock *sk, const struct ack_sample *sample)
 	struct bictcp *ca = inet_csk_ca(sk);
 	u32 delay;
 
+	if (ca->drain_cwnd)
+		search_drain(sk, sample->pkts_acked);
+
 	/* Some calls are for duplicates without timetamps */
 	if (sample->rtt_us < 0)
 		return;
 
 	/* Discard delay samples right after fast recovery */
-	if (ca->epoch_start && (s32)(tcp_jiffies32 - ca->epoch_start) < HZ)
+	if (ca->epoch_start &&
+	    (s32)(bictcp_epoch_now(sk) - ca->epoch_start) < bictcp_epoch_hz(ca))
 		return;
 
 	delay = sample->rtt_us;
@@ -701,21 +1737,139 @@ static void bictcp_acked(struct sock *sk, const struct ack_sample *sample)
 		ca->delay_min = delay;
 
 	//////////////////////// SEARCH ////////////////////////
-	if (search > 0 && !ca->stop_search) {
+	if (ca->search_mode > 0 && !ca->search.stop_search) {
 
-		if (!tcp_in_slow_start(tp))
-			ca->stop_search = 1;
-		else
+		if (!tcp_in_slow_start(tp)) {
+			ca->search.stop_search = 1;
+		} else {
+			/* the delay signal first, a SEARCH exit on this ACK
+			 * is judged with it
+			 */
+			if (SEARCH_HYSTART && ca->hybrid_policy)
+				search_hystart_update(sk, delay);
 			/* implement search algorithm */
-       		search_update(sk, delay);
+			if (!ca->search_rs && !ca->search.stop_search)
+				search_update(sk, delay, sample->pkts_acked);
+		}
 	}
 
+	if (ca->search_adapt)
+		search_adapt_update(sk);
+
 	/* hystart triggers when cwnd is larger than some threshold */
-	if (!ca->found && tcp_in_slow_start(tp) && hystart &&
+	if (!ca->search_mode && !ca->hystart.found && tcp_in_slow_start(tp) && hystart &&
 	    tp->snd_cwnd >= hystart_low_window)
 		hystart_update(sk, delay);
 }
 
+/* cong_control takes cwnd reduction and pacing over from TCP, these
+ * follow tcp_cwnd_reduction() (PRR without the SSRB bonus, the ACK flags
+ * are private to tcp_input.c) and tcp_update_pacing_rate(), neither of
+ * which modules can call
+ */
+static void bictcp_cwnd_reduction(struct sock *sk, int newly_acked_sacked)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int delta = tp->snd_ssthresh - tcp_packets_in_flight(tp);
+	int sndcnt;
+
+	if (newly_acked_sacked <= 0 || !tp->prior_cwnd)
+		return;
+
+	tp->prr_delivered += newly_acked_sacked;
+	if (delta < 0) {
+		u64 dividend = (u64)tp->snd_ssthresh * tp->prr_delivered +
+			       tp->prior_cwnd - 1;
+
+		sndcnt = div_u64(dividend, tp->prior_cwnd) - tp->prr_out;
+	} else {
+		sndcnt = max_t(int, tp->prr_delivered - tp->prr_out,
+			       newly_acked_sacked);
+		sndcnt = min(delta, sndcnt);
+	}
+	/* Force a fast retransmit upon entering fast recovery */
+	sndcnt = max(sndcnt, (tp->prr_out ? 0 : 1));
+	tp->snd_cwnd = tcp_packets_in_flight(tp) + sndcnt;
+}
+
+static void bictcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	const struct net *net = sock_net(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+	u64 rate;
+
+	/* the delivered rate of the last window while draining the overshoot */
+	if (ca->drain_cwnd && search_exited(ca)->drain_rate) {
+		rate = (u64)search_exited(ca)->drain_rate * MSEC_PER_SEC;
+		WRITE_ONCE(sk->sk_pacing_rate,
+			   min_t(u64, rate, READ_ONCE(sk->sk_max_pacing_rate)));
+		return;
+	}
+
+	/* mss * cwnd / srtt, at 200% in slow start and 120% otherwise */
+	rate = (u64)tp->mss_cache * ((USEC_PER_SEC / 100) << 3);
+	if (tp->snd_cwnd < tp->snd_ssthresh / 2)
+		rate *= READ_ONCE(net->ipv4.sysctl_tcp_pacing_ss_ratio);
+	else
+		rate *= READ_ONCE(net->ipv4.sysctl_tcp_pacing_ca_ratio);
+
+	rate *= max(tp->snd_cwnd, tp->packets_out);
+	if (likely(tp->srtt_us))
+		do_div(rate, tp->srtt_us);
+
+	WRITE_ONCE(sk->sk_pacing_rate, min_t(u64, rate, READ_ONCE(sk->sk_max_pacing_rate)));
+}
+
+/* ACK flags of tcp_input.c, which does not export them */
+#define SEARCH_FLAG_DATA_ACKED		0x04	/* this ACK acknowledged new data */
+#define SEARCH_FLAG_SYN_ACKED		0x10	/* this ACK acknowledged SYN */
+#define SEARCH_FLAG_DATA_SACKED		0x20	/* new SACK */
+#define SEARCH_FLAG_FORWARD_PROGRESS	(SEARCH_FLAG_DATA_ACKED | SEARCH_FLAG_SYN_ACKED | \
+					 SEARCH_FLAG_DATA_SACKED)
+
+/* tcp_may_raise_cwnd(), which tcp_cong_control() checks before it calls
+ * cong_avoid: grow cwnd on in-order delivery only (RFC 5681), or on any
+ * delivery once reordering is high
+ */
+static bool bictcp_may_raise_cwnd(const struct sock *sk, int flag)
+{
+	if (tcp_sk(sk)->reordering >
+	    READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_reordering))
+		return flag & SEARCH_FLAG_FORWARD_PROGRESS;
+
+	return flag & SEARCH_FLAG_DATA_ACKED;
+}
+
+static void bictcp_cong_control(struct sock *sk, u32 ack, int flag,
+				const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	if (ca->search_mode > 0 && !ca->search.stop_search &&
+	    tcp_in_slow_start(tp) && rs->delivered > 0)
+		search_update_rs(sk, rs);
+
+	/* CWR and Recovery reduce cwnd, the other states grow it as
+	 * tcp_cong_control() would
+	 */
+	if (tcp_in_cwnd_reduction(sk))
+		bictcp_cwnd_reduction(sk, rs->acked_sacked);
+	else if (bictcp_may_raise_cwnd(sk, flag) && rs->acked_sacked > 0)
+		bictcp_cong_avoid(sk, ack, rs->acked_sacked);
+
+	bictcp_update_pacing_rate(sk);
+}
+
+static void bictcp_rs_init(struct sock *sk)
+{
+	struct bictcp *ca = inet_csk_ca(sk);
+
+	bictcp_init(sk);
+	ca->search_rs = 1;
+}
+
 static struct tcp_congestion_ops cubicsearch __read_mostly = {
 	.init		= bictcp_init,
 	.ssthresh	= bictcp_recalc_ssthresh,
@@ -723,14 +1877,291 @@ static struct tcp_congestion_ops cubicsearch __read_mostly = {
 	.set_state	= bictcp_state,
 	.undo_cwnd	= tcp_reno_undo_cwnd,
 	.cwnd_event	= bictcp_cwnd_event,
+	.in_ack_event	= bictcp_in_ack_event,
 	.pkts_acked	= bictcp_acked,
 	.owner		= THIS_MODULE,
-	.name		= "cubic_search",
+	.name		= SEARCH_CA_NAME,
+};
+
+/* Same algorithm with SEARCH driven by rate samples from cong_control */
+static struct tcp_congestion_ops cubicsearch_rs __read_mostly = {
+	.init		= bictcp_rs_init,
+	.ssthresh	= bictcp_recalc_ssthresh,
+	.cong_control	= bictcp_cong_control,
+	.set_state	= bictcp_state,
+	.undo_cwnd	= tcp_reno_undo_cwnd,
+	.cwnd_event	= bictcp_cwnd_event,
+	.in_ack_event	= bictcp_in_ack_event,
+	.pkts_acked	= bictcp_acked,
+	.owner		= THIS_MODULE,
+	.name		= SEARCH_CA_NAME "_rs",
+};
+
+static int search_mib_seq_show(struct seq_file *seq, void *v)
+{
+	struct search_net *sn = net_generic(seq_file_single_net(seq), search_net_id);
+	int i, cpu;
+
+	for (i = 0; i < __SEARCH_MIB_MAX; i++) {
+		unsigned long val = 0;
+
+		for_each_possible_cpu(cpu)
+			val += per_cpu_ptr(sn->mib, cpu)->mibs[i];
+		seq_printf(seq, "%s %lu\n", search_mib_names[i], val);
+	}
+
+	return 0;
+}
+
+static int search_hist_seq_show(struct seq_file *seq, void *v)
+{
+	struct search_net *sn = net_generic(seq_file_single_net(seq), search_net_id);
+	int i, b, cpu;
+
+	for (i = 0; i < __SEARCH_HIST_MAX; i++) {
+		seq_printf(seq, "%s", search_hist_names[i]);
+		for (b = 0; b < SEARCH_HIST_BUCKETS; b++) {
+			unsigned long val = 0;
+
+			for_each_possible_cpu(cpu)
+				val += per_cpu_ptr(sn->hist, cpu)->buckets[i][b];
+			seq_printf(seq, " %lu", val);
+		}
+		seq_putc(seq, '\n');
+	}
+
+	return 0;
+}
+
+static int search_window_size_time_max = SEARCH_MAX_WINDOW_SIZE_TIME;
+static int search_confirm_max = SEARCH_MAX_CONFIRM;
+static int search_hystart_policy_max = SEARCH_HYSTART_VETO;
+
+/* net.ipv4.tcp_search.*, .data is filled in per netns */
+static struct ctl_table search_sysctl_table[] = {
+	{
+		.procname	= "search",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_TWO,
+	},
+	{
+		.procname	= "search_window_size_time",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &search_window_size_time_max,
+	},
+	{
+		.procname	= "search_thresh",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE_HUNDRED,
+	},
+	{
+		.procname	= "cwnd_rollback",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_TWO,
+	},
+	{
+		.procname	= "do_intpld",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "rebin",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "rearm",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "dst_cache_timeout",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_jiffies,
+	},
+	{
+		.procname	= "hystart_policy",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &search_hystart_policy_max,
+	},
+	{
+		.procname	= "ecn",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "group",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "confirm",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &search_confirm_max,
+	},
+	{
+		.procname	= "adapt",
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+};
+
+static int search_sysctl_register(struct net *net, struct search_net *sn)
+{
+	struct ctl_table *table;
+
+	/* every namespace starts from the module parameters */
+	sn->search = clamp(search, 0, 2);
+	sn->window_size_time = clamp(search_window_size_time, 1, SEARCH_MAX_WINDOW_SIZE_TIME);
+	sn->thresh = clamp(search_thresh, 0, 100);
+	sn->cwnd_rollback = clamp(cwnd_rollback, SEARCH_ROLLBACK_NONE, SEARCH_ROLLBACK_DRAIN);
+	sn->do_intpld = clamp(do_intpld, 0, 1);
+	sn->rebin = clamp(rebin, 0, 1);
+	sn->rearm = clamp(rearm, 0, 1);
+	sn->dst_cache_timeout = clamp(dst_cache_timeout, 0, INT_MAX / HZ) * HZ;
+	sn->hystart_policy = clamp(hystart_policy, SEARCH_HYSTART_OFF, SEARCH_HYSTART_VETO);
+	sn->ecn = clamp(ecn, 0, 1);
+	sn->group = clamp(group, 0, 1);
+	sn->confirm = clamp(confirm, 1, SEARCH_MAX_CONFIRM);
+	sn->adapt = clamp(adapt, 0, 1);
+
+	table = kmemdup(search_sysctl_table, sizeof(search_sysctl_table), GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+
+	table[0].data = &sn->search;
+	table[1].data = &sn->window_size_time;
+	table[2].data = &sn->thresh;
+	table[3].data = &sn->cwnd_rollback;
+	table[4].data = &sn->do_intpld;
+	table[5].data = &sn->rebin;
+	table[6].data = &sn->rearm;
+	table[7].data = &sn->dst_cache_timeout;
+	table[8].data = &sn->hystart_policy;
+	table[9].data = &sn->ecn;
+	table[10].data = &sn->group;
+	table[11].data = &sn->confirm;
+	table[12].data = &sn->adapt;
+
+	sn->sysctl_hdr = register_net_sysctl_sz(net, SEARCH_ENTRY("net/ipv4/tcp_search"), table,
+						ARRAY_SIZE(search_sysctl_table));
+	if (!sn->sysctl_hdr) {
+		kfree(table);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void search_sysctl_unregister(struct search_net *sn)
+{
+	const struct ctl_table *table = sn->sysctl_hdr->ctl_table_arg;
+
+	unregister_net_sysctl_table(sn->sysctl_hdr);
+	kfree(table);
+}
+
+static int __net_init search_net_init(struct net *net)
+{
+	struct search_net *sn = net_generic(net, search_net_id);
+	int ret;
+
+	ret = search_sysctl_register(net, sn);
+	if (ret)
+		return ret;
+
+	sn->mib = alloc_percpu(struct search_mib);
+	if (!sn->mib)
+		goto err_sysctl;
+
+	sn->hist = alloc_percpu(struct search_hist);
+	if (!sn->hist)
+		goto err_mib;
+
+	if (!proc_create_net_single(SEARCH_ENTRY("tcp_search"), 0444, net->proc_net,
+				    search_mib_seq_show, NULL))
+		goto err_hist;
+
+	if (!proc_create_net_single(SEARCH_ENTRY("tcp_search_stats"), 0444, net->proc_net,
+				    search_hist_seq_show, NULL))
+		goto err_proc;
+
+	return 0;
+
+err_proc:
+	remove_proc_entry(SEARCH_ENTRY("tcp_search"), net->proc_net);
+err_hist:
+	free_percpu(sn->hist);
+err_mib:
+	free_percpu(sn->mib);
+err_sysctl:
+	search_sysctl_unregister(sn);
+	return -ENOMEM;
+}
+
+static void __net_exit search_net_exit(struct net *net)
+{
+	struct search_net *sn = net_generic(net, search_net_id);
+
+	remove_proc_entry(SEARCH_ENTRY("tcp_search_stats"), net->proc_net);
+	remove_proc_entry(SEARCH_ENTRY("tcp_search"), net->proc_net);
+	search_dst_flush(net);
+	search_group_flush(net);
+	free_percpu(sn->hist);
+	free_percpu(sn->mib);
+	search_sysctl_unregister(sn);
+}
+
+static struct pernet_operations search_net_ops = {
+	.init	= search_net_init,
+	.exit	= search_net_exit,
+	.id	= &search_net_id,
+	.size	= sizeof(struct search_net),
 };
 
 static int __init cubicsearch_register(void)
 {
+	int ret;
+
 	BUILD_BUG_ON(sizeof(struct bictcp) > ICSK_CA_PRIV_SIZE);
+	BUILD_BUG_ON(sizeof(SEARCH_CA_NAME "_rs") > TCP_CA_NAME_MAX);
 
 	/* Precompute a bunch of the scaling factors that are used per-packet
 	 * based on SRTT of 100ms
@@ -760,12 +2191,32 @@ static int __init cubicsearch_register(void)
 	/* divide by bic_scale and by constant Srtt (100ms) */
 	do_div(cube_factor, bic_scale * 10);
 
-	return tcp_register_congestion_control(&cubicsearch);
+	ret = register_pernet_subsys(&search_net_ops);
+	if (ret)
+		return ret;
+
+	ret = tcp_register_congestion_control(&cubicsearch);
+	if (ret)
+		goto err_pernet;
+
+	ret = tcp_register_congestion_control(&cubicsearch_rs);
+	if (ret)
+		goto err_cubicsearch;
+
+	return 0;
+
+err_cubicsearch:
+	tcp_unregister_congestion_control(&cubicsearch);
+err_pernet:
+	unregister_pernet_subsys(&search_net_ops);
+	return ret;
 }
 
 static void __exit cubicsearch_unregister(void)
 {
+	tcp_unregister_congestion_control(&cubicsearch_rs);
 	tcp_unregister_congestion_control(&cubicsearch);
+	unregister_pernet_subsys(&search_net_ops);
 }
 
 module_init(cubicsearch_register);
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * TCP Reno with the SEARCH slow start exit.
+ *
+ * Congestion avoidance, ssthresh and undo are the kernel's Reno, only
+ * slow start ends at the capacity choke point found by SEARCH instead of
+ * at the first loss. See tcp_ss_search.h for wiring SEARCH into other
+ * congestion controls.
+ */
+
+#include <linux/module.h>
+#include <net/tcp.h>
+#include "tcp_ss_search.h"
+
+static int search_window_size_time __read_mostly = 35;
+static int search_thresh __read_mostly = 35;
+static int cwnd_rollback __read_mostly = 1;
+
+module_param(search_window_size_time, int, 0444);
+MODULE_PARM_DESC(search_window_size_time, "Multiply with (initial RTT / 10) to set the window size");
+module_param(search_thresh, int, 0444);
+MODULE_PARM_DESC(search_thresh, "Threshold for exiting from slow start in percentage");
+module_param(cwnd_rollback, int, 0444);
+MODULE_PARM_DESC(cwnd_rollback, "Decrease the cwnd to its value in 2 initial RTT ago");
+
+struct renosearch {
+	struct search_state search;
+	struct search_params params;	/* taken when the flow was created */
+};
+
+static void renosearch_init(struct sock *sk)
+{
+	struct renosearch *ca = inet_csk_ca(sk);
+
+	ca->params = (struct search_params) {
+		.window_size_time	= clamp(search_window_size_time, 1,
+						SEARCH_MAX_WINDOW_SIZE_TIME),
+		.thresh			= clamp(search_thresh, 0, 100),
+		.do_intpld		= 1,
+		.cwnd_rollback		= cwnd_rollback ? SEARCH_ROLLBACK_STEP :
+							  SEARCH_ROLLBACK_NONE,
+		.rebin			= 1,
+	};
+	tcp_ss_search_reset(&ca->search);
+}
+
+static void renosearch_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	struct renosearch *ca = inet_csk_ca(sk);
+
+	if (event == CA_EVENT_CWND_RESTART)
+		tcp_ss_search_reset(&ca->search);
+}
+
+static void renosearch_state(struct sock *sk, u8 new_state)
+{
+	struct renosearch *ca = inet_csk_ca(sk);
+
+	/* slow start again after an RTO */
+	if (new_state == TCP_CA_Loss)
+		tcp_ss_search_reset(&ca->search);
+}
+
+static void renosearch_acked(struct sock *sk, const struct ack_sample *sample)
+{
+	struct renosearch *ca = inet_csk_ca(sk);
+
+	tcp_ss_search_acked(sk, &ca->search, &ca->params, sample);
+}
+
+static struct tcp_congestion_ops renosearch __read_mostly = {
+	.init		= renosearch_init,
+	.ssthresh	= tcp_reno_ssthresh,
+	.cong_avoid	= tcp_reno_cong_avoid,
+	.set_state	= renosearch_state,
+	.undo_cwnd	= tcp_reno_undo_cwnd,
+	.cwnd_event	= renosearch_cwnd_event,
+	.pkts_acked	= renosearch_acked,
+	.owner		= THIS_MODULE,
+	.name		= "reno_search",
+};
+
+static int __init renosearch_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct renosearch) > ICSK_CA_PRIV_SIZE);
+
+	return tcp_register_congestion_control(&renosearch);
+}
+
+static void __exit renosearch_unregister(void)
+{
+	tcp_unregister_congestion_control(&renosearch);
+}
+
+module_init(renosearch_register);
+module_exit(renosearch_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP Reno w/ SEARCH");
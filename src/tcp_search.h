@@ -0,0 +1,644 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * SEARCH: Slow start Exit At Right CHoke point
+ *
+ * The SEARCH state machine shared by tcp_cubic_search.c, the FreeBSD
+ * port in freebsd-src, the userspace trace replay tool in tools/search_sim
+ * and the userspace library in lib/search_cc.h. It only depends on the clock, the cumulative bytes
+ * acked and the RTT sample handed in by the caller, so the same code runs
+ * in the kernel and in userspace.
+ *
+ * Time is divided into bins holding the cumulative bytes acked at the end
+ * of each bin. On every bin boundary the bytes delivered over the last
+ * window of SEARCH_BINS bins are compared with the bytes delivered one RTT
+ * earlier. When the delivered bytes no longer grow with the sending rate,
+ * the capacity choke point has been reached and slow start should end.
+ */
+#ifndef _TCP_SEARCH_H
+#define _TCP_SEARCH_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/math64.h>
+#elif defined(__bpf__)
+/* BPF programs get the kernel types from vmlinux.h */
+#ifndef U32_MAX
+#define U32_MAX	((u32)~0U)
+#endif
+
+#define memset(s, c, n)	__builtin_memset(s, c, n)
+#define memcpy(d, s, n)	__builtin_memcpy(d, s, n)
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+#elif defined(__FreeBSD__) && defined(_KERNEL)
+/* freebsd-src/cc_cubic_search.c, bool and memset come from the kernel */
+#include <sys/types.h>
+#include <sys/systm.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#if !defined(__KERNEL__) && !defined(__bpf__)
+/* define SEARCH_HAVE_TYPES when the program already has these */
+#ifndef SEARCH_HAVE_TYPES
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+#endif
+
+#ifndef U32_MAX
+#define U32_MAX	((u32)~0U)
+#endif
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+#endif
+
+#define SEARCH_MAX_BIN_VALUE 0xffff	/* Largest value a scaled bin can hold */
+/* The bin geometry is fixed at compile time; a build variant may override
+ * it (see SEARCH_VARIANTS in the Makefile). A power of two total turns the
+ * ring index into a mask.
+ */
+#ifndef SEARCH_BINS
+#define SEARCH_BINS 10		/* Number of bins in a window */
+#endif
+#ifndef SEARCH_EXTRA_BINS
+#define SEARCH_EXTRA_BINS 15	/* Number of additional bins to cover data after shifting by RTT */
+#endif
+#define SEARCH_TOTAL_BINS (SEARCH_BINS + SEARCH_EXTRA_BINS)	/* Total number of bins containing
+								   essential bins to cover RTT shift */
+#ifndef SEARCH_INTERPOLATE
+#define SEARCH_INTERPOLATE 1	/* 0 compiles out search_params.do_intpld */
+#endif
+#define SEARCH_MIN_BIN_DURATION 2	/* Shortest bin in microsecond, keeps the
+					   reciprocal of the duration within u32 */
+#define SEARCH_RECIP_SHIFT 32		/* Fixed point precision of bin_duration_inv */
+#define SEARCH_FRAC_SHIFT 16		/* Fixed point precision of a fraction of a bin */
+#define SEARCH_BASE_SHIFT 16		/* Low bits of the delivered bytes not kept in
+					   search_state.delivered_base */
+
+/* Flags returned by search_process() */
+enum {
+	SEARCH_BIN_CLOSED = 1 << 0,	/* a bin was closed */
+	SEARCH_EXIT = 1 << 1,		/* choke point found, exit slow start */
+	SEARCH_MISSED_RESET = 1 << 2,	/* missed bins wiped out the whole history */
+	SEARCH_REBIN = 1 << 3,		/* bins were merged or split to follow the RTT */
+	SEARCH_SHIFT_GUARD = 1 << 4,	/* the RTT shift ran past the bins kept,
+					   the windows were not compared */
+	SEARCH_LIMITED = 1 << 5,	/* the windows held sender limited bins,
+					   they were not compared */
+	SEARCH_UNCONFIRMED = 1 << 6,	/* over thresh, short of p->confirm bins in a row */
+};
+
+#define SEARCH_MISSED_BINS_LIMIT 2	/* More bins than this without an ACK and
+					   the sender had nothing in flight */
+#define SEARCH_MAX_VALID_BINS 31	/* Saturation of search_state.valid_bins, more
+					   than the two windows and the largest shift */
+#define SEARCH_MAX_CONFIRM 7		/* Largest search_params.confirm */
+
+#define SEARCH_MAX_WINDOW_SIZE_TIME 255	/* Largest window_size_time a flow can hold */
+
+/* cwnd_rollback modes */
+#define SEARCH_ROLLBACK_NONE	0
+#define SEARCH_ROLLBACK_STEP	1	/* cwnd drops to the target at the exit */
+#define SEARCH_ROLLBACK_DRAIN	2	/* cwnd drains to the target over one RTT */
+
+/* Tunables, snapshotted per flow from the configuration */
+struct search_params {
+	u8	window_size_time;	/* window size as a multiple of initial RTT / 10 */
+	u8	thresh;			/* exit threshold in percentage */
+	u8	do_intpld:1,		/* interpolate the previous window */
+		cwnd_rollback:2,	/* SEARCH_ROLLBACK_*, done by the caller */
+		rebin:1,		/* resize bins when the RTT drifts */
+		confirm:3;		/* bins in a row over thresh to exit, 0 as 1 */
+};
+
+/* Per-flow SEARCH state */
+struct search_state {
+	u32	bin_duration_us; 	/* duration of each bin in microsecond */
+	u32	bin_duration_inv;	/* 2^SEARCH_RECIP_SHIFT / bin_duration_us, rounded up */
+	u32	bin_total; 		/* total number of bins */
+	u32	bin_end_us; 		/* end time of the latest bin in microsecond */
+	u32	delivered_base;		/* delivered bytes >> SEARCH_BASE_SHIFT when the
+					 * search started, bins count from there
+					 */
+	u16	bin[SEARCH_TOTAL_BINS];	/* cumulative bytes acked at the end of each bin,
+					 * right shifted by scale_factor. Once stop_search
+					 * is set and search_overshoot_bytes() was taken,
+					 * the caller may reuse them until search_reset()
+					 */
+	u8	stop_search:1,		/* the choke/exit point based on SEARCH is found */
+		bin_limited:1,		/* the open bin saw a sender limited delivery */
+		scale_factor:6;		/* shift applied to fit bytes acked in a bin */
+	u8	valid_bins:5,		/* bins closed since the last limited one */
+		over_thresh:3;		/* bins in a row over thresh, not yet confirmed */
+};
+
+/* What search_process() saw when it closed a bin */
+struct search_sample {
+	u32	bin_total;		/* index of the bin just closed */
+	u32	rtt_shift;		/* whole bins the previous window is shifted by */
+	u64	curr_delv_bytes;	/* bytes delivered in the current window */
+	u64	prev_delv_bytes;	/* bytes delivered in the window one RTT earlier,
+					 * both 0 when the windows were not compared
+					 */
+};
+
+/* Ring position of bin @i */
+static inline u32 search_idx(u32 i)
+{
+	u32 idx = i % SEARCH_TOTAL_BINS;
+
+#ifdef __bpf__
+	/* the verifier does not track the range of a modulo */
+	asm volatile("" : "+r"(idx));
+	if (idx >= SEARCH_TOTAL_BINS)
+		idx = 0;
+#endif
+	return idx;
+}
+
+static inline void search_reset(struct search_state *s)
+{
+	memset(s->bin, 0, sizeof(s->bin));
+	s->bin_duration_us = 0;
+	s->bin_duration_inv = 0;
+	s->bin_total = 0;
+	s->bin_end_us = 0;
+	s->delivered_base = 0;
+	s->stop_search = 0;
+	s->bin_limited = 0;
+	s->scale_factor = 0;
+	s->valid_bins = 0;
+	s->over_thresh = 0;
+}
+
+/* Set the bin duration, along with its reciprocal. This is the only
+ * division by the bin duration, on the ACK path it is a multiply.
+ */
+static inline void search_set_bin_duration(struct search_state *s, u32 bin_duration_us)
+{
+	s->bin_duration_us = bin_duration_us;
+	s->bin_duration_inv = div_u64((1ULL << SEARCH_RECIP_SHIFT) +
+				      bin_duration_us - 1, bin_duration_us);
+}
+
+/* Size the bins from @rtt_us and open the first one at @now_us, counting
+ * delivery from @delivered_bytes on
+ */
+static inline void search_start(struct search_state *s, const struct search_params *p,
+				u32 now_us, u32 rtt_us, u64 delivered_bytes)
+{
+	u32 bin_duration_us = div_u64((u64)rtt_us * p->window_size_time, SEARCH_BINS * 10);
+
+	search_set_bin_duration(s, bin_duration_us < SEARCH_MIN_BIN_DURATION ?
+				   SEARCH_MIN_BIN_DURATION : bin_duration_us);
+	s->bin_end_us = now_us + s->bin_duration_us;
+	s->delivered_base = delivered_bytes >> SEARCH_BASE_SHIFT;
+}
+
+/* Bytes delivered since the search started. Bins hold cumulative values
+ * in 16 bits, so the scale they need follows the bytes of this search
+ * rather than of the whole connection, which after a restart of slow
+ * start on a long lived flow would leave a window only a few units wide.
+ * Good for 2^48 bytes per search, the caller's counter may wrap at 2^64.
+ */
+static inline u64 search_delivered_since(const struct search_state *s, u64 delivered_bytes)
+{
+	u32 high = (u32)(delivered_bytes >> SEARCH_BASE_SHIFT) - s->delivered_base;
+
+	return ((u64)high << SEARCH_BASE_SHIFT) |
+	       (delivered_bytes & ((1 << SEARCH_BASE_SHIFT) - 1));
+}
+
+/* Scale bin value to fit bin size, rescale previous bins.
+ * Return amount scaled.
+ */
+static inline u8 search_bit_shifting(struct search_state *s, u64 bin_value)
+{
+	u8 num_shift = 0;
+	u32 i = 0;
+
+	/* Adjust bin_value if it's greater than SEARCH_MAX_BIN_VALUE */
+	while (bin_value > SEARCH_MAX_BIN_VALUE) {
+		num_shift += 1;
+		bin_value >>= 1;  /* divide bin_value by 2 */
+	}
+
+	/* Adjust all previous bins according to the new num_shift */
+	for (i = 0; i < SEARCH_TOTAL_BINS; i++)
+		s->bin[i] >>= num_shift;
+
+	/* Update the scale factor */
+	s->scale_factor += num_shift;
+
+	return num_shift;
+}
+
+/* Return @bytes_acked in bin units, rescaling the ring when they no
+ * longer fit in a bin
+ */
+static inline u16 search_bin_value(struct search_state *s, u64 bytes_acked)
+{
+	u64 bin_value = bytes_acked >> s->scale_factor;
+
+	if (bin_value > SEARCH_MAX_BIN_VALUE)
+		bin_value >>= search_bit_shifting(s, bin_value);
+
+	return bin_value;
+}
+
+/* Divide @time_us by the bin duration with a multiply and a shift.
+ * Returns the quotient in fixed point with SEARCH_RECIP_SHIFT fractional
+ * bits, i.e. whole bins in the upper half and a fraction of a bin below.
+ */
+static inline u64 search_time_to_bins(const struct search_state *s, u32 time_us)
+{
+	return (u64)time_us * s->bin_duration_inv;
+}
+
+/* Cumulative bin value at @t_us when the bin units from @prev to @curr
+ * were delivered evenly over [@start_us, @now_us]
+ */
+static inline u16 search_interpolate(u16 prev, u16 curr, u32 start_us, u32 now_us, u32 t_us)
+{
+	if ((s32)(now_us - t_us) <= 0)
+		return curr;
+	if ((s32)(t_us - start_us) <= 0)
+		return prev;
+
+	return prev + div_u64((u64)(u16)(curr - prev) * (t_us - start_us), now_us - start_us);
+}
+
+/* Function to update missed bins, returns the number of bins missed.
+ * @prev_bytes is the value of the last closed bin and @bin_value the
+ * value now. With @start_us equal to @now_us everything was acked at
+ * once and the missed bins carry @prev_bytes, otherwise the bytes are
+ * spread over [@start_us, @now_us] by search_interpolate().
+ */
+static inline u32 search_update_missed_bins(struct search_state *s, u32 start_us, u32 now_us,
+					    u16 prev_bytes, u16 bin_value)
+{
+	u32 missed_bin = 0;
+	u32 i = 0;
+
+	missed_bin = search_time_to_bins(s, now_us - s->bin_end_us) >> SEARCH_RECIP_SHIFT;
+
+	if (missed_bin > 0) {
+		for (i = 0; i < missed_bin && i < SEARCH_TOTAL_BINS; i++)
+			s->bin[search_idx(s->bin_total + i)] = start_us == now_us ? prev_bytes :
+				search_interpolate(prev_bytes, bin_value, start_us, now_us,
+						   s->bin_end_us + i * s->bin_duration_us);
+
+		s->bin_total += missed_bin;
+		s->bin_end_us += missed_bin * s->bin_duration_us;
+	}
+
+	return missed_bin;
+}
+
+/* Calculate delivered bytes for the window of SEARCH_BINS bins ending at
+ * bin @index, shifted back in time by @fraction of a bin, in Q16
+ * (SEARCH_FRAC_SHIFT fractional bits).
+ * Bins hold cumulative counts, so this is a difference of two entries plus
+ * a correction for the partially covered bins at each edge.
+ * The caller guarantees that index - SEARCH_BINS - 1 is still in the ring.
+ * The result is in bin units, i.e. bytes right shifted by scale_factor.
+ */
+static inline u64 search_compute_delivered_window(const struct search_state *s, u32 index, u32 fraction)
+{
+	u16 right = s->bin[search_idx(index)];
+	u16 left = s->bin[search_idx(index - SEARCH_BINS)];
+	u64 delivered_bytes = (u16)(right - left);
+
+	if (fraction) {
+		u16 right_bin = right - s->bin[search_idx(index - 1)];
+		u16 left_bin = left - s->bin[search_idx(index - SEARCH_BINS - 1)];
+
+		delivered_bytes -= ((u64)right_bin * fraction) >> SEARCH_FRAC_SHIFT;
+		delivered_bytes += ((u64)left_bin * fraction) >> SEARCH_FRAC_SHIFT;
+	}
+
+	return delivered_bytes;
+}
+
+/* The bins are sized from the first RTT sample. When that sample was
+ * inflated, by SYN processing or a slow handshake, and the RTT then drops
+ * below half of it, the two windows nearly overlap and the bins are split
+ * in two. When the RTT grows until the shift would run past the bins kept
+ * in the ring, which would stop the windows from being compared at all,
+ * bins are merged pairwise. RTT growth short of that is the queue building
+ * at the choke point and keeps the bins as they are. Bin @s->bin_total was
+ * just recorded and stays a bin boundary. Returns true if the bins were
+ * resized.
+ */
+static inline bool search_rebin(struct search_state *s, const struct search_params *p,
+				u64 rtt_bins)
+{
+	u16 old[SEARCH_TOTAL_BINS];
+	u64 rtt_x = (rtt_bins >> 16) * p->window_size_time;
+	u32 n = s->bin_total;
+	u32 i, k;
+
+	if ((rtt_bins >> SEARCH_RECIP_SHIFT) >= SEARCH_EXTRA_BINS - 1) {
+		/* merge: every other cumulative value is a boundary of a bin
+		 * twice as long, SEARCH_TOTAL_BINS / 2 of them are known
+		 */
+		memcpy(old, s->bin, sizeof(old));
+		s->bin_total = n / 2;
+		for (i = 0; i < SEARCH_TOTAL_BINS; i++) {
+			k = i < SEARCH_TOTAL_BINS / 2 ? 2 * i : SEARCH_TOTAL_BINS - 1;
+			/* bins older than the ring stay flat, so they cannot
+			 * look like a drop in delivery
+			 */
+			if (k > n)
+				k = n;
+			s->bin[search_idx(s->bin_total - i)] = old[search_idx(n - k)];
+		}
+		search_set_bin_duration(s, 2 * s->bin_duration_us);
+		s->valid_bins /= 2;
+		return true;
+	}
+
+	/* rtt_x is SEARCH_BINS * 10 << 16 at the RTT the bins were sized for */
+	if (rtt_x < (u64)(SEARCH_BINS * 10 / 2) << 16 &&
+	    s->bin_duration_us >= 2 * SEARCH_MIN_BIN_DURATION) {
+		/* split: the new boundaries in between are interpolated, the
+		 * oldest half of the ring is dropped
+		 */
+		memcpy(old, s->bin, sizeof(old));
+		s->bin_total = 2 * n;
+		for (i = 0; i < SEARCH_TOTAL_BINS; i++) {
+			u32 j = i / 2 < n ? i / 2 : n;
+			u16 right = old[search_idx(n - j)];
+
+			if ((i & 1) && j < n) {
+				u16 left = old[search_idx(n - j - 1)];
+
+				right -= (u16)(right - left) / 2;
+			}
+			s->bin[search_idx(s->bin_total - i)] = right;
+		}
+		search_set_bin_duration(s, s->bin_duration_us / 2);
+		return true;
+	}
+
+	return false;
+}
+
+/* Bytes delivered over the last two initial RTTs, i.e. how far cwnd
+ * overshot the choke point by the time SEARCH detected it
+ */
+static inline u64 search_overshoot_bytes(const struct search_state *s, const struct search_params *p)
+{
+	u32 congestion_index = 0;
+	u32 span = 0, fraction = 0;
+	u64 overshoot_bytes = 0;
+
+	/* two initial RTTs expressed in bins, the bin duration cancels out.
+	 * After search_rebin() these are RTTs as the bins are sized now.
+	 * The part of a bin beyond the whole ones is taken from the bin
+	 * before, as search_compute_delivered_window() does.
+	 */
+	span = ((2 * SEARCH_BINS * 10) << SEARCH_FRAC_SHIFT) /
+	       (p->window_size_time ? p->window_size_time : 1);
+	if ((span >> SEARCH_FRAC_SHIFT) >= SEARCH_TOTAL_BINS - 1)
+		span = (SEARCH_TOTAL_BINS - 1) << SEARCH_FRAC_SHIFT;
+	else
+		fraction = span & ((1 << SEARCH_FRAC_SHIFT) - 1);
+	congestion_index = s->bin_total - (span >> SEARCH_FRAC_SHIFT);
+
+	overshoot_bytes = (u16)(s->bin[search_idx(s->bin_total)] -
+				s->bin[search_idx(congestion_index)]);
+	if (fraction)
+		overshoot_bytes += ((u64)(u16)(s->bin[search_idx(congestion_index)] -
+					       s->bin[search_idx(congestion_index - 1)]) *
+				    fraction) >> SEARCH_FRAC_SHIFT;
+
+	return overshoot_bytes << s->scale_factor;
+}
+
+/* The cwnd to go on with after the exit: @cwnd less the @overshoot of
+ * search_overshoot_bytes(), in the same unit, not below @min_cwnd, and
+ * @min_cwnd when the overshoot is all of cwnd. Every rollback uses it.
+ */
+static inline u64 search_rollback_cwnd(u64 cwnd, u64 overshoot, u64 min_cwnd)
+{
+	if (overshoot >= cwnd || cwnd - overshoot < min_cwnd)
+		return min_cwnd;
+
+	return cwnd - overshoot;
+}
+
+/* Bytes delivered over the last @rtt_us up to the end of bin @last, the
+ * part of a bin beyond the whole ones taken from the bin before. Returns
+ * 0 while the bins do not reach back that far.
+ */
+static inline u64 search_delivered_rtt_at(const struct search_state *s, u32 last,
+					  u32 rtt_us)
+{
+	u64 rtt_bins = search_time_to_bins(s, rtt_us);
+	u32 shift = rtt_bins >> SEARCH_RECIP_SHIFT;
+	u32 fraction = (rtt_bins & U32_MAX) >> (SEARCH_RECIP_SHIFT - SEARCH_FRAC_SHIFT);
+	u64 delivered_bytes = 0;
+
+	if (shift + 1 > last || shift + 2 >= SEARCH_TOTAL_BINS)
+		return 0;
+
+	delivered_bytes = (u16)(s->bin[search_idx(last)] - s->bin[search_idx(last - shift)]);
+	if (fraction)
+		delivered_bytes += ((u64)(u16)(s->bin[search_idx(last - shift)] -
+					       s->bin[search_idx(last - shift - 1)]) *
+				    fraction) >> SEARCH_FRAC_SHIFT;
+
+	return delivered_bytes << s->scale_factor;
+}
+
+/* search_delivered_rtt_at() up to the last closed bin while searching,
+ * i.e. s->bin_total is the open bin. On SEARCH_EXIT s->bin_total is the
+ * bin just closed, use search_delivered_rtt_at(s, s->bin_total, rtt_us).
+ */
+static inline u64 search_delivered_rtt(const struct search_state *s, u32 rtt_us)
+{
+	return search_delivered_rtt_at(s, s->bin_total - 1, rtt_us);
+}
+
+/* Move on to the next bin, done by search_process_delivered() unless it
+ * returns SEARCH_EXIT; a caller that does not take the exit calls it to
+ * keep searching
+ */
+static inline void search_next_bin(struct search_state *s)
+{
+	s->bin_end_us = s->bin_end_us + s->bin_duration_us;
+	s->bin_total++;
+}
+
+/* Back to the bin search_process_delivered() just closed without an exit,
+ * for a caller that learned of the choke point elsewhere: the bins are as
+ * on SEARCH_EXIT, so search_overshoot_bytes() can be used
+ */
+static inline void search_prev_bin(struct search_state *s)
+{
+	s->bin_end_us = s->bin_end_us - s->bin_duration_us;
+	s->bin_total--;
+}
+
+/* Feed a delivery into SEARCH: @delivered_bytes is the cumulative count
+ * at @now_us, the bytes delivered since the last call having arrived over
+ * [@start_us, @now_us], and @rtt_us is the RTT sample. Bins closing inside
+ * that interval are credited by delivery time rather than all at @now_us.
+ * While @limited the sender, by the application or the receive window,
+ * not the path limited the delivery: the bin it falls into is recorded,
+ * but windows holding it are left out of the exit test. So are the bins
+ * of a gap of more than SEARCH_MISSED_BINS_LIMIT bins without an ACK.
+ * Returns 0 while inside the current bin, otherwise SEARCH_BIN_CLOSED
+ * along with the other flags that apply, and fills @sample.
+ * On SEARCH_EXIT, s->bin_total still refers to the bin that just closed,
+ * so search_overshoot_bytes() can be used before the next call.
+ */
+static inline int search_process_delivered(struct search_state *s, const struct search_params *p,
+					   u32 start_us, u32 now_us, u64 delivered_bytes,
+					   u32 rtt_us, bool limited,
+					   struct search_sample *sample)
+{
+	u16 prev_value = 0;
+	u16 bin_value = 0;
+	u32 curr_index = 0;
+	s32 prev_index = 0;
+	u64 curr_delv_bytes = 0, prev_delv_bytes = 0;
+	u64 rtt_bins = 0;
+	u32 fraction = 0;
+	u32 missed_bins = 0;
+	bool over = false;
+	int ret = SEARCH_BIN_CLOSED;
+
+	/* by receiving the first ack packet, initialize bin duration and bin end time */
+	if (s->bin_duration_us == 0)
+		search_start(s, p, now_us, rtt_us, delivered_bytes);
+
+	if (limited)
+		s->bin_limited = 1;
+
+	/* check if it's reached the bin boundary, the usec clock wraps
+	 * every 71 minutes
+	 */
+	if ((s32)(now_us - s->bin_end_us) <= 0)
+		return 0;
+
+	bin_value = search_bin_value(s, search_delivered_since(s, delivered_bytes));
+	prev_value = s->bin_total > 0 ? s->bin[search_idx(s->bin_total - 1)] : bin_value;
+
+	/* a count of acked plus SACKed bytes drops when the SACK scoreboard
+	 * is cleared, hold it at the last bin or the windows go negative
+	 */
+	if (bin_value < prev_value)
+		bin_value = prev_value;
+
+	/* Check and update missed bins */
+	missed_bins = search_update_missed_bins(s, start_us, now_us, prev_value, bin_value);
+	if (missed_bins >= SEARCH_TOTAL_BINS)
+		ret |= SEARCH_MISSED_RESET;
+
+	/* the bins closed now are valid unless the sender held back */
+	if (s->bin_limited || missed_bins > SEARCH_MISSED_BINS_LIMIT)
+		s->valid_bins = 0;
+	else
+		s->valid_bins = s->valid_bins + missed_bins + 1 > SEARCH_MAX_VALID_BINS ?
+				SEARCH_MAX_VALID_BINS : s->valid_bins + missed_bins + 1;
+	s->bin_limited = 0;
+
+	/* record cumulative delivered bytes at the end of the bin, an ACK
+	 * closing the bin is credited to it in full
+	 */
+	s->bin[search_idx(s->bin_total)] = start_us == now_us ? bin_value :
+		search_interpolate(prev_value, bin_value, start_us, now_us, s->bin_end_us);
+
+	/* calculate indices for the current window and previous window after shifting by current RTT */
+	rtt_bins = search_time_to_bins(s, rtt_us);
+	if (p->rebin && search_rebin(s, p, rtt_bins)) {
+		ret |= SEARCH_REBIN;
+		rtt_bins = search_time_to_bins(s, rtt_us);
+	}
+	curr_index = s->bin_total;
+	prev_index = s->bin_total - (u32)(rtt_bins >> SEARCH_RECIP_SHIFT);
+
+	/* check if there is enough bins after shift for computing previous window */
+	if (prev_index > SEARCH_BINS && (curr_index - prev_index) >= SEARCH_EXTRA_BINS - 1) {
+		ret |= SEARCH_SHIFT_GUARD;
+	} else if (prev_index > SEARCH_BINS) {
+
+		/* the previous window is shifted back by the part of the RTT
+		 * that does not fill a whole bin
+		 */
+		if (SEARCH_INTERPOLATE && p->do_intpld == 1)
+			fraction = (rtt_bins & U32_MAX) >> (SEARCH_RECIP_SHIFT - SEARCH_FRAC_SHIFT);
+
+		/* Calculate delivered bytes for the current and previous windows */
+		curr_delv_bytes = search_compute_delivered_window(s, curr_index, 0);
+		prev_delv_bytes = search_compute_delivered_window(s, prev_index, fraction);
+
+		/* both windows, with the partial bin before the previous
+		 * one, need bins the sender did not limit
+		 */
+		if (s->valid_bins <= curr_index - prev_index + SEARCH_BINS) {
+			ret |= SEARCH_LIMITED;
+		} else if (prev_delv_bytes > 0) {
+			/* check for exit condition, i.e. the normalized difference
+			 * ((2 * prev) - curr) / (2 * prev) reaching search_thresh percent,
+			 * cross multiplied to avoid the division
+			 */
+			over = (2 * prev_delv_bytes) >= curr_delv_bytes &&
+			       ((2 * prev_delv_bytes) - curr_delv_bytes) * 100 >=
+			       (u64)p->thresh * (2 * prev_delv_bytes);
+		}
+	}
+
+	/* a window shortfall from link layer scheduling rarely lasts, one
+	 * at the choke point does: exit on p->confirm bins in a row over
+	 * the threshold. A caller not taking the exit gets it again on the
+	 * next bin over it.
+	 */
+	if (!over) {
+		s->over_thresh = 0;
+	} else if (s->over_thresh + 1 < p->confirm) {
+		s->over_thresh++;
+		ret |= SEARCH_UNCONFIRMED;
+	} else {
+		ret |= SEARCH_EXIT;
+	}
+
+	sample->bin_total = s->bin_total;
+	sample->rtt_shift = curr_index - prev_index;
+	sample->curr_delv_bytes = curr_delv_bytes << s->scale_factor;
+	sample->prev_delv_bytes = prev_delv_bytes << s->scale_factor;
+
+	if (ret & SEARCH_EXIT)
+		return ret;
+
+	search_next_bin(s);
+
+	return ret;
+}
+
+/* Feed one ACK into SEARCH: @now_us is the current time, @bytes_acked the
+ * cumulative bytes acked so far and @rtt_us the RTT sample of this ACK.
+ * Everything acked since the last call is credited at @now_us.
+ */
+static inline int search_process(struct search_state *s, const struct search_params *p,
+				 u32 now_us, u64 bytes_acked, u32 rtt_us,
+				 struct search_sample *sample)
+{
+	return search_process_delivered(s, p, now_us, now_us, bytes_acked, rtt_us,
+					false, sample);
+}
+
+#endif /* _TCP_SEARCH_H */
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Tracepoints for SEARCH decisions, available as tcp_search:* in perf,
+ * bpftrace and /sys/kernel/tracing/events/tcp_search once the module is
+ * loaded. They cost a static branch each while disabled. A build variant
+ * gets its own system, tcp_search_<variant>.
+ */
+#undef TRACE_SYSTEM
+#ifdef SEARCH_VARIANT
+#define TRACE_SYSTEM __PASTE(tcp_search_, SEARCH_VARIANT)
+#else
+#define TRACE_SYSTEM tcp_search
+#endif
+
+#if !defined(_TCP_SEARCH_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TCP_SEARCH_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <net/inet_sock.h>
+
+#include "tcp_search.h"
+
+/* A bin was closed and, once enough bins exist, the two windows compared */
+TRACE_EVENT(tcp_search_bin,
+
+	TP_PROTO(const struct sock *sk, const struct search_state *s,
+		 const struct search_sample *sample, u32 rtt_us),
+
+	TP_ARGS(sk, s, sample, rtt_us),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(__u32, bin_total)
+		__field(__u32, bin_duration_us)
+		__field(__u32, rtt_us)
+		__field(__u64, curr_delv_bytes)
+		__field(__u64, prev_delv_bytes)
+		__field(__u8, scale_factor)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->bin_total = sample->bin_total;
+		__entry->bin_duration_us = s->bin_duration_us;
+		__entry->rtt_us = rtt_us;
+		__entry->curr_delv_bytes = sample->curr_delv_bytes;
+		__entry->prev_delv_bytes = sample->prev_delv_bytes;
+		__entry->scale_factor = s->scale_factor;
+	),
+
+	TP_printk("skaddr=%p sport=%hu dport=%hu bin_total=%u bin_duration_us=%u rtt_us=%u curr_delv=%llu prev_delv=%llu scale=%u",
+		  __entry->skaddr, __entry->sport, __entry->dport,
+		  __entry->bin_total, __entry->bin_duration_us, __entry->rtt_us,
+		  __entry->curr_delv_bytes, __entry->prev_delv_bytes,
+		  __entry->scale_factor)
+);
+
+/* The choke point was found. norm_diff is ((2 * prev) - curr) / (2 * prev)
+ * in percent, only computed here so the ACK path never divides.
+ */
+TRACE_EVENT(tcp_search_exit,
+
+	TP_PROTO(const struct sock *sk, const struct search_sample *sample, u32 cwnd),
+
+	TP_ARGS(sk, sample, cwnd),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(__u32, bin_total)
+		__field(__u64, curr_delv_bytes)
+		__field(__u64, prev_delv_bytes)
+		__field(__u32, norm_diff)
+		__field(__u32, cwnd)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->bin_total = sample->bin_total;
+		__entry->curr_delv_bytes = sample->curr_delv_bytes;
+		__entry->prev_delv_bytes = sample->prev_delv_bytes;
+		__entry->norm_diff = sample->prev_delv_bytes ?
+			div64_u64((2 * sample->prev_delv_bytes - sample->curr_delv_bytes) * 100,
+				  2 * sample->prev_delv_bytes) : 0;
+		__entry->cwnd = cwnd;
+	),
+
+	TP_printk("skaddr=%p sport=%hu dport=%hu bin_total=%u curr_delv=%llu prev_delv=%llu norm_diff=%u%% cwnd=%u",
+		  __entry->skaddr, __entry->sport, __entry->dport,
+		  __entry->bin_total, __entry->curr_delv_bytes,
+		  __entry->prev_delv_bytes, __entry->norm_diff, __entry->cwnd)
+);
+
+/* cwnd was rolled back by the bytes delivered since the choke point */
+TRACE_EVENT(tcp_search_rollback,
+
+	TP_PROTO(const struct sock *sk, u32 cwnd_before, u32 cwnd_after),
+
+	TP_ARGS(sk, cwnd_before, cwnd_after),
+
+	TP_STRUCT__entry(
+		__field(const void *, skaddr)
+		__field(__u16, sport)
+		__field(__u16, dport)
+		__field(__u32, cwnd_before)
+		__field(__u32, cwnd_after)
+	),
+
+	TP_fast_assign(
+		__entry->skaddr = sk;
+		__entry->sport = ntohs(inet_sk(sk)->inet_sport);
+		__entry->dport = ntohs(inet_sk(sk)->inet_dport);
+		__entry->cwnd_before = cwnd_before;
+		__entry->cwnd_after = cwnd_after;
+	),
+
+	TP_printk("skaddr=%p sport=%hu dport=%hu cwnd_before=%u cwnd_after=%u",
+		  __entry->skaddr, __entry->sport, __entry->dport,
+		  __entry->cwnd_before, __entry->cwnd_after)
+);
+
+#endif /* _TCP_SEARCH_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tcp_search_trace
+#include <trace/define_trace.h>
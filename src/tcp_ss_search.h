@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * SEARCH slow start exit for any loss based congestion control.
+ *
+ * The bins, the exit test and the rollback come from tcp_search.h, this
+ * adds the glue to a struct sock so that a congestion control only has to
+ * keep a struct search_state in its private area and:
+ *
+ *	.init, on CA_EVENT_CWND_RESTART and on entering TCP_CA_Loss:
+ *		tcp_ss_search_reset(&ca->search);
+ *	.pkts_acked:
+ *		tcp_ss_search_acked(sk, &ca->search, &params, sample);
+ *
+ * or call tcp_ss_search_update() with its own clock and delivered count.
+ * Once SEARCH finds the choke point, ssthresh is set to the (rolled back)
+ * cwnd and slow start ends through the normal slow start test.
+ */
+#ifndef _TCP_SS_SEARCH_H
+#define _TCP_SS_SEARCH_H
+
+#include <net/tcp.h>
+#include "tcp_search.h"
+
+static inline void tcp_ss_search_reset(struct search_state *s)
+{
+	search_reset(s);
+}
+
+/* End slow start at the choke point, rolling cwnd back by the bytes
+ * delivered since then if asked to, not below TCP_INIT_CWND. An overshoot
+ * of the whole cwnd starts over from TCP_INIT_CWND.
+ */
+static inline void tcp_ss_search_exit(struct sock *sk, struct search_state *s,
+				      const struct search_params *p)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (p->cwnd_rollback != SEARCH_ROLLBACK_NONE) {
+		tp->snd_cwnd = search_rollback_cwnd(tp->snd_cwnd,
+						    div_u64(search_overshoot_bytes(s, p),
+							    tp->mss_cache),
+						    TCP_INIT_CWND);
+	}
+
+	s->stop_search = 1;
+	tp->snd_ssthresh = tp->snd_cwnd;
+}
+
+/* Feed SEARCH @delivered bytes at @now_us with the RTT sample @rtt_us.
+ * Bins filled while the application or the receive window held the
+ * sender back are left out of the exit test. Returns the search_process()
+ * flags, SEARCH_EXIT once slow start was ended.
+ */
+static inline int tcp_ss_search_update(struct sock *sk, struct search_state *s,
+				       const struct search_params *p,
+				       u32 now_us, u64 delivered, u32 rtt_us)
+{
+	struct search_sample sample;
+	int ret;
+
+	if (s->stop_search)
+		return 0;
+
+	if (!tcp_in_slow_start(tcp_sk(sk))) {
+		s->stop_search = 1;
+		return 0;
+	}
+
+	ret = search_process_delivered(s, p, now_us, now_us, delivered, rtt_us,
+				       tcp_sk(sk)->app_limited || !tcp_is_cwnd_limited(sk),
+				       &sample);
+	if (ret & SEARCH_EXIT)
+		tcp_ss_search_exit(sk, s, p);
+
+	return ret;
+}
+
+/* The .pkts_acked hook, counting bytes acked on the ACK clock */
+static inline int tcp_ss_search_acked(struct sock *sk, struct search_state *s,
+				      const struct search_params *p,
+				      const struct ack_sample *sample)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+
+	/* Some calls are for duplicates without timetamps */
+	if (sample->rtt_us < 0)
+		return 0;
+
+	return tcp_ss_search_update(sk, s, p, tp->tcp_mstamp, tp->bytes_acked,
+				    max_t(u32, sample->rtt_us, 1));
+}
+
+#endif /* _TCP_SS_SEARCH_H */
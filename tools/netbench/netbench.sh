@@ -0,0 +1,240 @@
+#!/bin/sh
+# Per-ACK cost and slow start behaviour of cubic, cubic with HyStart and
+# cubic_search over an emulated bottleneck.
+#
+#	sudo ./netbench.sh -c "cubic cubic_hystart cubic_search" \
+#		-r "10 50" -b "100 1000" -q "0.5 2" -f "1 4" -n 3 > results.csv
+#
+# Three namespaces are chained with veth pairs:
+#
+#	nb_cli (iperf3 -c) -- nb_rtr -- nb_srv (iperf3 -s)
+#
+# The router shapes the data direction with tbf at the bottleneck rate,
+# with a queue of the given multiple of the BDP, and delays the ACK
+# direction with netem by the RTT. Each run sends -s bytes per flow and
+# prints one CSV line:
+#
+#	config		cubic, cubic_hystart or cubic_search
+#	rtt_ms, rate_mbit, buffer_bdp, flows, rep	the matrix point
+#	acks		calls of the congestion control's pkts_acked hook
+#	ns_per_ack	mean time spent in it (bpftrace fentry/fexit)
+#	softirq_pct	softirq share of all CPUs during the transfer
+#	fct_ms		flow completion time reported by iperf3
+#	ss_exit_ms	mean time from the first ACK to ssthresh being set
+#	retrans		TcpRetransSegs of the sender namespace
+#	peak_queue_bytes	largest bottleneck backlog seen, sampled every 10 ms
+#
+# Needs root, iproute2, iperf3 and bpftrace with BTF. cubic_search has to
+# be loaded. The HyStart configurations toggle the hystart parameter of
+# the kernel's tcp_cubic (or slow_start_mode of ../../src/tcp_cubic.c when
+# that replaces it) and restore it afterwards.
+
+CONFIGS="cubic cubic_hystart cubic_search"
+RTTS="10 50 200"
+RATES="100 1000"
+BUFFERS="1"
+FLOWS="1"
+REPS=1
+SIZE=100M
+PORT=5201
+HEADER=1
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [options]
+  -c <configs>  configurations (default "$CONFIGS")
+  -r <ms..>     base RTTs in ms (default "$RTTS")
+  -b <mbit..>   bottleneck rates in Mbit/s (default "$RATES")
+  -q <bdp..>    bottleneck queue in BDPs (default "$BUFFERS")
+  -f <n..>      parallel flows (default "$FLOWS")
+  -n <n>        repetitions of every point (default $REPS)
+  -s <bytes>    bytes sent per flow, iperf3 suffixes allowed (default $SIZE)
+  -H            do not print the CSV header
+EOF
+	exit 2
+}
+
+while getopts c:r:b:q:f:n:s:H opt; do
+	case $opt in
+	c) CONFIGS=$OPTARG ;;
+	r) RTTS=$OPTARG ;;
+	b) RATES=$OPTARG ;;
+	q) BUFFERS=$OPTARG ;;
+	f) FLOWS=$OPTARG ;;
+	n) REPS=$OPTARG ;;
+	s) SIZE=$OPTARG ;;
+	H) HEADER=0 ;;
+	*) usage ;;
+	esac
+done
+
+for tool in ip tc iperf3 bpftrace; do
+	command -v $tool >/dev/null || { echo "$0: $tool not found" >&2; exit 1; }
+done
+[ "$(id -u)" = 0 ] || { echo "$0: must run as root" >&2; exit 1; }
+
+TMP=$(mktemp -d)
+CUBIC_PARAMS=/sys/module/tcp_cubic/parameters
+SAVED_SS=
+
+cleanup() {
+	[ -n "$SAVED_SS" ] && echo "$SAVED_SS" > "$SS_PARAM"
+	for ns in nb_cli nb_rtr nb_srv; do
+		ip netns del $ns 2>/dev/null
+	done
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+# the stock module toggles HyStart with hystart, src/tcp_cubic.c with
+# slow_start_mode (0: none, 2: HyStart)
+if [ -w $CUBIC_PARAMS/slow_start_mode ]; then
+	SS_PARAM=$CUBIC_PARAMS/slow_start_mode
+	SS_OFF=0 SS_ON=2
+else
+	SS_PARAM=$CUBIC_PARAMS/hystart
+	SS_OFF=0 SS_ON=1
+fi
+[ -r "$SS_PARAM" ] && SAVED_SS=$(cat "$SS_PARAM")
+
+setup() {
+	for ns in nb_cli nb_rtr nb_srv; do
+		ip netns add $ns
+		ip -n $ns link set lo up
+	done
+	ip link add c2r netns nb_cli type veth peer name r2c netns nb_rtr
+	ip link add s2r netns nb_srv type veth peer name r2s netns nb_rtr
+	ip -n nb_cli addr add 10.77.1.1/24 dev c2r
+	ip -n nb_rtr addr add 10.77.1.2/24 dev r2c
+	ip -n nb_rtr addr add 10.77.2.2/24 dev r2s
+	ip -n nb_srv addr add 10.77.2.1/24 dev s2r
+	for l in "nb_cli c2r" "nb_rtr r2c" "nb_rtr r2s" "nb_srv s2r"; do
+		set -- $l
+		ip -n $1 link set $2 up
+		# segmentation offloads would hide the per-packet ACK clock
+		ip netns exec $1 ethtool -K $2 tso off gso off gro off 2>/dev/null
+	done
+	ip -n nb_cli route add default via 10.77.1.2
+	ip -n nb_srv route add default via 10.77.2.2
+	ip netns exec nb_rtr sysctl -qw net.ipv4.ip_forward=1
+}
+
+# <rtt_ms> <rate_mbit> <buffer_bdp>
+shape() {
+	limit=$(awk -v r="$1" -v b="$2" -v q="$3" \
+		'BEGIN { l = r / 1000 * b * 1000000 / 8 * q; printf "%d", l < 3000 ? 3000 : l }')
+	tc -n nb_rtr qdisc replace dev r2s root tbf rate "$2"mbit \
+		burst 32kb limit "$limit"
+	tc -n nb_rtr qdisc replace dev r2c root netem delay "$1"ms limit 100000
+}
+
+# cubic_search and cubic run under their own names, cubic_hystart is
+# cubic with HyStart turned on
+config_cc() {
+	case $1 in
+	cubic)		echo "$SS_OFF" > "$SS_PARAM"; CA=cubic PROBE=cubictcp_acked ;;
+	cubic_hystart)	echo "$SS_ON" > "$SS_PARAM"; CA=cubic PROBE=cubictcp_acked ;;
+	cubic_search)	CA=cubic_search PROBE=bictcp_acked ;;
+	*)		echo "$0: unknown configuration $1" >&2; exit 2 ;;
+	esac
+}
+
+# cost of the ACK hook and the first time ssthresh is set on every flow
+bt_script() {
+	cat <<EOF
+fentry:$PROBE { @start[tid] = nsecs; }
+fexit:$PROBE /@start[tid]/ {
+	@ns = sum(nsecs - @start[tid]); @acks = count(); delete(@start[tid]);
+}
+tracepoint:tcp:tcp_probe /args->dport == $PORT/ {
+	if (!@first[args->sport]) { @first[args->sport] = nsecs; }
+	if (args->ssthresh < 0x7fffffff && !@exit[args->sport]) {
+		@exit[args->sport] = nsecs - @first[args->sport];
+	}
+}
+END {
+	printf("ns %d\nacks %d\n", @ns, @acks);
+	print(@exit);
+	clear(@start); clear(@first); clear(@exit); clear(@ns); clear(@acks);
+}
+EOF
+}
+
+softirq_ticks() {
+	awk '/^cpu / { t = 0; for (i = 2; i <= NF; i++) t += $i; print $8, t }' /proc/stat
+}
+
+retrans_segs() {
+	ip netns exec nb_cli awk '/^Tcp:/ { if (!n) { for (i = 1; i <= NF; i++) if ($i == "RetransSegs") c = i; n = 1 } else print $c }' /proc/net/snmp
+}
+
+queue_poll() {
+	max=0
+	while [ ! -e "$TMP/stop" ]; do
+		b=$(tc -s -n nb_rtr qdisc show dev r2s | awk '/backlog/ { sub("b", "", $2); print $2; exit }')
+		[ "${b:-0}" -gt $max ] && max=$b
+		sleep 0.01
+	done
+	echo $max > "$TMP/queue"
+}
+
+# <config> <rtt> <rate> <buffer> <flows> <rep>
+run_one() {
+	config_cc "$1"
+	rm -f "$TMP/stop"
+	bt_script > "$TMP/probe.bt"
+	bpftrace "$TMP/probe.bt" > "$TMP/bt.out" 2>"$TMP/bt.err" &
+	bt=$!
+	# give bpftrace time to attach
+	sleep 2
+
+	queue_poll &
+	poll=$!
+	set -- "$@" $(softirq_ticks) $(retrans_segs)
+	# one test per server, a fresh one for every run
+	ip netns exec nb_srv iperf3 -s -D -p $PORT -1 >/dev/null 2>&1
+	sleep 0.2
+	ip netns exec nb_cli iperf3 -c 10.77.2.1 -p $PORT -C "$CA" -n "$SIZE" \
+		-P "$5" -J > "$TMP/iperf.json" 2>/dev/null
+	set -- "$@" $(softirq_ticks) $(retrans_segs)
+	touch "$TMP/stop"
+	wait $poll
+	kill -INT $bt
+	wait $bt
+
+	awk -v cfg="$1" -v rtt="$2" -v rate="$3" -v buf="$4" -v flows="$5" -v rep="$6" \
+	    -v si0="$7" -v t0="$8" -v rt0="$9" -v si1="${10}" -v t1="${11}" -v rt1="${12}" \
+	    -v queue="$(cat "$TMP/queue")" \
+	    -v fct="$(awk -F: '/"seconds"/ { s = $2 } END { gsub(/[ ,]/, "", s); print s * 1000 }' "$TMP/iperf.json")" '
+		$1 == "ns" { ns = $2 }
+		$1 == "acks" { acks = $2 }
+		/^@exit\[/ { exits += $2; nexit++ }
+		END {
+			printf "%s,%s,%s,%s,%s,%s,%d,%.1f,%.2f,%.1f,%.1f,%d,%d\n",
+			       cfg, rtt, rate, buf, flows, rep, acks,
+			       acks ? ns / acks : 0,
+			       t1 > t0 ? (si1 - si0) * 100 / (t1 - t0) : 0,
+			       fct,
+			       nexit ? exits / nexit / 1000000 : -1,
+			       rt1 - rt0, queue
+		}' "$TMP/bt.out"
+}
+
+setup
+[ $HEADER = 1 ] && echo "config,rtt_ms,rate_mbit,buffer_bdp,flows,rep,acks,ns_per_ack,softirq_pct,fct_ms,ss_exit_ms,retrans,peak_queue_bytes"
+for rtt in $RTTS; do
+	for rate in $RATES; do
+		for buf in $BUFFERS; do
+			shape "$rtt" "$rate" "$buf"
+			for flows in $FLOWS; do
+				rep=1
+				while [ $rep -le "$REPS" ]; do
+					for config in $CONFIGS; do
+						run_one "$config" "$rtt" "$rate" "$buf" "$flows" "$rep"
+					done
+					rep=$((rep + 1))
+				done
+			done
+		done
+	done
+done
@@ -0,0 +1,58 @@
+# Compare two netbench.sh CSVs, the baseline first:
+#
+#	awk -F, -v metrics="ns_per_ack fct_ms" -v max_pct=10 \
+#		-f regress.awk baseline.csv netbench.csv
+#
+# Repetitions are averaged per configuration and matrix point. Every point
+# whose mean of one of the metrics grew by more than max_pct percent over
+# the baseline is reported and the exit status is 1.
+
+BEGIN {
+	if (max_pct == "")
+		max_pct = 10
+	if (metrics == "")
+		metrics = "ns_per_ack"
+	nm = split(metrics, metric, " ")
+}
+
+FNR == 1 {
+	file++
+	for (i = 1; i <= NF; i++)
+		col[$i] = i
+	for (m = 1; m <= nm; m++)
+		if (!(metric[m] in col)) {
+			printf "regress: no column %s in %s\n", metric[m], FILENAME > "/dev/stderr"
+			bad = 2
+			exit
+		}
+	next
+}
+
+{
+	key = $col["config"] "," $col["rtt_ms"] "," $col["rate_mbit"] "," \
+	      $col["buffer_bdp"] "," $col["flows"]
+	n[file, key]++
+	for (m = 1; m <= nm; m++)
+		sum[file, key, metric[m]] += $col[metric[m]]
+	if (file == 2)
+		keys[key] = 1
+}
+
+END {
+	if (bad)
+		exit bad
+	for (key in keys) {
+		if (!((1, key) in n))
+			continue
+		for (m = 1; m <= nm; m++) {
+			base = sum[1, key, metric[m]] / n[1, key]
+			cur = sum[2, key, metric[m]] / n[2, key]
+			if (base > 0 && cur > base * (1 + max_pct / 100)) {
+				printf "%s: %s %.2f -> %.2f (+%.1f%%)\n", key, metric[m],
+				       base, cur, (cur - base) * 100 / base
+				regressed = 1
+			}
+		}
+	}
+	exit regressed
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Convert a sender side capture into a search_sim trace with tshark.
+#
+#	./pcap2trace.sh flow.pcap "tcp.srcport == 5201" > flow.trace
+#
+# The display filter must select the ACKs of a single flow travelling
+# back to the sender. tshark supplies the cumulative relative ACK number
+# and the RTT of the segment each ACK acknowledges.
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <pcap> <display filter selecting the ACKs>" >&2
+	exit 2
+fi
+
+tshark -r "$1" -Y "($2) && tcp.analysis.ack_rtt" -T fields \
+	-e frame.time_epoch -e tcp.ack -e tcp.analysis.ack_rtt |
+awk '{ printf "%.0f %d %.0f\n", $1 * 1000000, $2, $3 * 1000000 }'
@@ -0,0 +1,133 @@
+# Compare two search_sim CSVs, the baseline first, optionally after the
+# expected results:
+#
+#	awk -F, -v rollback_pct=5 -v ns_pct=10 -f regress.awk \
+#		[expect.csv] baseline.csv sim.csv
+#
+# A trace regressed when it stopped or started exiting, when its exit
+# moved by more than one bin of the baseline, when its rollback cwnd moved
+# by more than rollback_pct percent. The run regressed when its cost per
+# ACK, over the traces timed in both runs, grew by more than ns_pct percent.
+#
+# expect.csv, told apart by its exit_bin column, holds what each trace
+# should do whatever the baseline: whether it exits, in which bin counted
+# from choke_us, give or take one, and the range of its rollback cwnd in
+# percent of the BDP. Every regression is reported and the exit status is 1.
+
+BEGIN {
+	if (rollback_pct == "")
+		rollback_pct = 5
+	if (ns_pct == "")
+		ns_pct = 10
+}
+
+function abs(x) {
+	return x < 0 ? -x : x
+}
+
+FNR == 1 {
+	delete col
+	for (i = 1; i <= NF; i++)
+		col[$i] = i
+	if ("exit_bin" in col) {
+		expect = 1
+		next
+	}
+	file++
+	if (!("bin_us" in col)) {
+		printf "regress: no column bin_us in %s\n", FILENAME > "/dev/stderr"
+		bad = 2
+		exit
+	}
+	next
+}
+
+file == 0 {
+	want_exit[$1] = $col["exit"]
+	want_bin[$1] = $col["exit_bin"]
+	want_rollback_min[$1] = $col["rollback_min_pct"]
+	want_rollback_max[$1] = $col["rollback_max_pct"]
+	next
+}
+
+file == 1 {
+	base_exit[$1] = $col["exit"]
+	base_time[$1] = $col["exit_time_us"]
+	base_rollback[$1] = $col["rollback_cwnd"]
+	base_ns[$1] = $col["ns_per_ack"]
+	base_acks[$1] = $col["acks"]
+	base_bin[$1] = $col["bin_us"]
+	next
+}
+
+expect && !($1 in want_exit) {
+	printf "%s: no expected result\n", $1
+	regressed = 1
+}
+
+$1 in want_exit {
+	if ($col["exit"] != want_exit[$1]) {
+		printf "%s: exit %d, expected %d\n", $1, $col["exit"], want_exit[$1]
+		regressed = 1
+	} else if ($col["exit"]) {
+		bin = int(($col["exit_time_us"] - $col["choke_us"]) / $col["bin_us"])
+		if (abs(bin - want_bin[$1]) > 1) {
+			printf "%s: exit in bin %d of the choke point, expected %d\n",
+			       $1, bin, want_bin[$1]
+			regressed = 1
+		}
+		pct = $col["bdp"] ? $col["rollback_cwnd"] * 100 / $col["bdp"] : 0
+		if (pct < want_rollback_min[$1] || pct > want_rollback_max[$1]) {
+			printf "%s: rollback_cwnd %.0f%% of the BDP, expected %d-%d%%\n",
+			       $1, pct, want_rollback_min[$1], want_rollback_max[$1]
+			regressed = 1
+		}
+	}
+}
+
+!($1 in base_exit) {
+	next
+}
+
+$col["exit"] != base_exit[$1] {
+	printf "%s: exit %d -> %d\n", $1, base_exit[$1], $col["exit"]
+	regressed = 1
+	next
+}
+
+{
+	if ($col["exit"] && abs($col["exit_time_us"] - base_time[$1]) > base_bin[$1]) {
+		printf "%s: exit_time_us %d -> %d (bin %d)\n", $1, base_time[$1],
+		       $col["exit_time_us"], base_bin[$1]
+		regressed = 1
+	}
+	if ($col["exit"] && base_rollback[$1] > 0 &&
+	    abs($col["rollback_cwnd"] - base_rollback[$1]) * 100 > base_rollback[$1] * rollback_pct) {
+		printf "%s: rollback_cwnd %d -> %d (%+.1f%%)\n", $1, base_rollback[$1],
+		       $col["rollback_cwnd"],
+		       ($col["rollback_cwnd"] - base_rollback[$1]) * 100 / base_rollback[$1]
+		regressed = 1
+	}
+	# a single trace is too short to time on its own
+	if (base_ns[$1] > 0 && $col["ns_per_ack"] > 0) {
+		base_ns_total += base_ns[$1] * base_acks[$1]
+		base_acks_total += base_acks[$1]
+		ns_total += $col["ns_per_ack"] * $col["acks"]
+		acks_total += $col["acks"]
+	}
+}
+
+END {
+	if (bad)
+		exit bad
+	if (acks_total) {
+		base_ns_total /= base_acks_total
+		ns_total /= acks_total
+		if (ns_total > base_ns_total * (1 + ns_pct / 100)) {
+			printf "ns_per_ack %.2f -> %.2f (+%.1f%%)\n", base_ns_total,
+			       ns_total, (ns_total - base_ns_total) * 100 / base_ns_total
+			regressed = 1
+		}
+	}
+	exit regressed
+}
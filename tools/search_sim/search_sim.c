@@ -0,0 +1,568 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * search_sim: replay ACK timelines through the SEARCH core
+ *
+ * Feeds recorded or synthetic ACK timelines into the same SEARCH state
+ * machine tcp_cubic_search.c runs in the kernel (src/tcp_search.h) and
+ * reports where slow start would have been exited.
+ *
+ * A trace is a text file with one ACK per line:
+ *
+ *	<timestamp_us> <bytes_acked> <rtt_us> [<cwnd_bytes> [<limited>]]
+ *
+ * bytes_acked is cumulative, as in tcp_info and tcp.ack in a capture.
+ * A non-zero limited marks an ACK of a sender held back by the
+ * application or the receive window, its bin is left out of the exit test.
+ * Timestamps and bytes acked are rebased to the first line. Lines starting
+ * with '#' are ignored. See ss2trace.awk and pcap2trace.sh for converters.
+ *
+ * One CSV line is printed per trace:
+ *	trace		trace file name, or the synthetic profile
+ *	acks		number of ACKs fed into SEARCH
+ *	exit		1 if SEARCH found the choke point
+ *	exit_time_us	time of the exit relative to the first ACK
+ *	exit_cwnd	cwnd in bytes at the exit, from the trace when it has a
+ *			cwnd column, otherwise the bytes delivered over the
+ *			last RTT
+ *	rollback_cwnd	cwnd in bytes after the SEARCH cwnd rollback
+ *	bdp		true BDP in bytes (-b, known for synthetic profiles,
+ *			otherwise the max bytes delivered over any min RTT)
+ *	overshoot_pct	(exit_cwnd - bdp) / bdp in percent
+ *	ns_per_ack	mean cost of SEARCH per ACK, with -n > 1, in the
+ *			fastest of SIM_TIMING_ROUNDS rounds of n replays
+ *	bin_us		bin duration at the exit (or at the end of the trace)
+ *	choke_us	time of the first ACK for which cwnd covered the BDP,
+ *			known for synthetic profiles only, otherwise 0
+ *
+ * Synthetic profiles (-s) are a bottleneck rate and base RTT, optionally
+ * followed by a scenario and its argument, which starts once cwnd reaches
+ * a quarter of the BDP:
+ *	flat		the rate and RTT stay the same (default)
+ *	step,<pct>	the bottleneck rate drops to pct percent
+ *	compress,<n>	ACKs arrive in batches of n
+ *	applimited,<ms>	the application stops sending for ms
+ *	rtt,<pct>	the base RTT grows by pct percent
+ *	gap,<ms>	no ACK arrives for ms, then all of them at once
+ *	jitter,<pct>	every ACK is held up to pct percent of the base RTT,
+ *			as by link layer scheduling (same sequence every run)
+ * With -L the ACKs go through lib/search_cc.h instead, as a userspace
+ * transport feeds them, which has to print the same lines.
+ * See regress.awk to compare two runs.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcp_search.h"
+#include "search_cc.h"
+
+#define SIM_INIT_CWND	10	/* TCP_INIT_CWND */
+#define SIM_MAX_CWND	8	/* stop synthetic profiles at this many BDPs */
+#define SIM_MAX_PROFILES 64
+#define SIM_TIMING_ROUNDS 5	/* keep the fastest, the others were interrupted */
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+struct ack {
+	u32	ts_us;
+	u64	bytes_acked;
+	u32	rtt_us;
+	u64	cwnd;		/* 0 when the trace has no cwnd column */
+	bool	limited;
+};
+
+struct trace {
+	const char	*name;
+	struct ack	*acks;
+	size_t		nr;
+	size_t		size;
+	u64		bdp;	/* 0 if unknown */
+	u32		choke_us; /* 0 if unknown */
+};
+
+struct result {
+	size_t	acks;
+	int	exit;
+	u32	exit_time_us;
+	u64	exit_cwnd;
+	u64	rollback_cwnd;
+	u32	bin_us;
+};
+
+static struct search_params params = {
+	.window_size_time	= 35,
+	.thresh			= 35,
+	.do_intpld		= 1,
+	.cwnd_rollback		= 1,
+	.rebin			= 1,
+};
+static u32 mss = 1448;
+static u64 bdp_override;
+static unsigned long iterations = 1;
+static bool use_lib;
+static int header = 1;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [trace...]\n"
+		"  -w <n>         search_window_size_time (default %u)\n"
+		"  -t <n>         search_thresh in percent (default %u)\n"
+		"  -i <0|1>       do_intpld (default %u)\n"
+		"  -r <0|1>       cwnd_rollback (default %u)\n"
+		"  -R <0|1>       rebin (default %u)\n"
+		"  -c <n>         bins in a row over the threshold to exit (default 1)\n"
+		"  -m <bytes>     MSS (default %u)\n"
+		"  -b <bytes>     true BDP, overrides the estimate\n"
+		"  -n <n>         replay each trace n times to time it (default 1)\n"
+		"  -L             replay through lib/search_cc.h\n"
+		"  -s <mbps,ms[,scenario,arg]>\n"
+		"                 synthetic slow start over a bottleneck of mbps\n"
+		"                 with a base RTT of ms, may be repeated\n"
+		"  -H             do not print the CSV header\n"
+		"A trace of '-', or no trace and no -s, reads standard input.\n",
+		prog, params.window_size_time, params.thresh,
+		params.do_intpld, params.cwnd_rollback, params.rebin, mss);
+	exit(2);
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		perror("realloc");
+		exit(1);
+	}
+	return ptr;
+}
+
+static void trace_add(struct trace *t, u32 ts_us, u64 bytes_acked, u32 rtt_us, u64 cwnd,
+		      bool limited)
+{
+	struct ack *a;
+
+	if (t->nr == t->size) {
+		t->size = t->size ? 2 * t->size : 4096;
+		t->acks = xrealloc(t->acks, t->size * sizeof(*t->acks));
+	}
+
+	a = &t->acks[t->nr++];
+	a->ts_us = ts_us;
+	a->bytes_acked = bytes_acked;
+	a->rtt_us = rtt_us ? rtt_us : 1;
+	a->cwnd = cwnd;
+	a->limited = limited;
+}
+
+static int trace_read(struct trace *t, const char *path)
+{
+	unsigned long long ts, bytes, rtt, cwnd, limited, ts0 = 0, bytes0 = 0;
+	FILE *f = stdin;
+	char line[256];
+
+	if (strcmp(path, "-")) {
+		f = fopen(path, "r");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+
+		cwnd = 0;
+		limited = 0;
+		if (sscanf(line, "%llu %llu %llu %llu %llu", &ts, &bytes, &rtt, &cwnd,
+			   &limited) < 3)
+			continue;
+
+		if (!t->nr) {
+			ts0 = ts;
+			bytes0 = bytes;
+		}
+		/* drop reordered lines rather than feeding time backwards */
+		if (ts < ts0 || bytes < bytes0)
+			continue;
+
+		trace_add(t, ts - ts0, bytes - bytes0, rtt, cwnd, limited);
+	}
+
+	if (f != stdin)
+		fclose(f);
+
+	t->name = path;
+	return 0;
+}
+
+enum sim_scenario {
+	SIM_FLAT,
+	SIM_STEP,
+	SIM_COMPRESS,
+	SIM_APPLIMITED,
+	SIM_RTT,
+	SIM_GAP,
+	SIM_JITTER,
+};
+
+static const char * const sim_scenarios[] = {
+	[SIM_FLAT]	= "flat",
+	[SIM_STEP]	= "step",
+	[SIM_COMPRESS]	= "compress",
+	[SIM_APPLIMITED] = "applimited",
+	[SIM_RTT]	= "rtt",
+	[SIM_GAP]	= "gap",
+	[SIM_JITTER]	= "jitter",
+};
+
+/* Slow start through a single FIFO bottleneck with an unlimited buffer:
+ * each ACK grows cwnd by one MSS and releases two segments, segments leave
+ * the bottleneck one serialization time apart and are acked one base RTT
+ * later. The scenario of @spec starts once cwnd reaches a quarter of the
+ * BDP, t->bdp is the BDP it leaves and t->choke_us the first ACK at which
+ * cwnd covered it, when the delivery rate stops growing.
+ */
+static void trace_synthetic(struct trace *t, const char *spec)
+{
+	u64 base_rtt_us, tx_ns, depart_ns = 0, ack_ns = 0, cwnd = SIM_INIT_CWND;
+	u64 start_ns = 0, end_ns = 0, last_ack_ns = 0;
+	u32 seed = 1;
+	size_t sent = 0, acked = 0, size = 0, batch = 0;
+	enum sim_scenario scenario = SIM_FLAT;
+	u64 *send_ns = NULL;
+	double mbps, rtt_ms, arg = 0;
+	char shape[16] = "flat";
+	bool started = false;
+	static char name[64];
+	int n;
+
+	n = sscanf(spec, "%lf,%lf,%15[a-z],%lf", &mbps, &rtt_ms, shape, &arg);
+	if (n < 2 || n == 3 || mbps <= 0 || rtt_ms <= 0)
+		goto bad;
+	for (scenario = 0; scenario < ARRAY_SIZE(sim_scenarios); scenario++)
+		if (!strcmp(shape, sim_scenarios[scenario]))
+			break;
+	if (scenario == ARRAY_SIZE(sim_scenarios) ||
+	    (scenario != SIM_FLAT && arg <= 0) ||
+	    (scenario == SIM_STEP && arg > 100))
+		goto bad;
+
+	base_rtt_us = rtt_ms * 1000;
+	tx_ns = mss * 8 * 1000 / mbps;
+	t->bdp = mbps * rtt_ms * 1000 / 8;
+
+	while (cwnd * mss <= SIM_MAX_CWND * t->bdp) {
+		bool limited = false;
+
+		if (!started && cwnd * mss >= t->bdp / 4) {
+			started = true;
+			start_ns = ack_ns;
+			end_ns = start_ns + arg * 1000000;
+			if (scenario == SIM_STEP) {
+				tx_ns = tx_ns * 100 / arg;
+				t->bdp = t->bdp * arg / 100;
+			} else if (scenario == SIM_RTT) {
+				base_rtt_us += base_rtt_us * arg / 100;
+				t->bdp += t->bdp * arg / 100;
+			}
+		}
+
+		if (scenario == SIM_APPLIMITED && started && ack_ns < end_ns) {
+			/* nothing new is sent, the application resumes once
+			 * what is in flight is acked and the pause is over
+			 */
+			limited = true;
+			if (sent == acked) {
+				ack_ns = end_ns;
+				continue;
+			}
+		} else {
+			/* release segments when the previous ACK arrives */
+			while (sent - acked < cwnd) {
+				if (sent == size) {
+					size = size ? 2 * size : 4096;
+					send_ns = xrealloc(send_ns, size * sizeof(*send_ns));
+				}
+				send_ns[sent++] = ack_ns;
+			}
+		}
+
+		/* the oldest segment is acked one base RTT after leaving the bottleneck */
+		if (send_ns[acked] > depart_ns)
+			depart_ns = send_ns[acked];
+		depart_ns += tx_ns;
+		ack_ns = depart_ns + base_rtt_us * 1000;
+		/* the ACK path stalls, everything acked meanwhile arrives at its end */
+		if (scenario == SIM_GAP && started && ack_ns < end_ns)
+			ack_ns = end_ns;
+		/* held by the link, but never reordered */
+		if (scenario == SIM_JITTER && started) {
+			seed = seed * 1103515245 + 12345;
+			ack_ns += (u64)(seed >> 16) * base_rtt_us * 10 * arg / 65536;
+			if (ack_ns < last_ack_ns)
+				ack_ns = last_ack_ns;
+			last_ack_ns = ack_ns;
+		}
+
+		acked++;
+		/* cwnd does not grow while the application holds it back */
+		if (!limited)
+			cwnd++;
+		/* only the last ACK of every batch arrives, covering the batch */
+		if (scenario == SIM_COMPRESS && started && ++batch < arg)
+			continue;
+		batch = 0;
+		if (!t->choke_us && started && cwnd * mss >= t->bdp)
+			t->choke_us = ack_ns / 1000;
+		trace_add(t, ack_ns / 1000, (u64)acked * mss,
+			  (ack_ns - send_ns[acked - 1]) / 1000, cwnd * mss, limited);
+	}
+
+	free(send_ns);
+	if (scenario == SIM_FLAT)
+		snprintf(name, sizeof(name), "synthetic:%g/%g", mbps, rtt_ms);
+	else
+		snprintf(name, sizeof(name), "synthetic:%g/%g/%s/%g", mbps, rtt_ms,
+			 sim_scenarios[scenario], arg);
+	t->name = name;
+	return;
+
+bad:
+	fprintf(stderr, "bad synthetic profile '%s'\n", spec);
+	exit(2);
+}
+
+/* Largest number of bytes delivered within any minimum RTT */
+static u64 trace_estimate_bdp(const struct trace *t)
+{
+	u32 min_rtt = U32_MAX;
+	u64 best = 0;
+	size_t l = 0, r;
+
+	for (r = 0; r < t->nr; r++)
+		if (t->acks[r].rtt_us < min_rtt)
+			min_rtt = t->acks[r].rtt_us;
+
+	for (r = 0; r < t->nr; r++) {
+		while (t->acks[r].ts_us - t->acks[l].ts_us > min_rtt)
+			l++;
+		if (t->acks[r].bytes_acked - t->acks[l].bytes_acked > best)
+			best = t->acks[r].bytes_acked - t->acks[l].bytes_acked;
+	}
+
+	return best;
+}
+
+/* cwnd at ACK @i: from the trace, or the bytes delivered over its RTT */
+static u64 trace_cwnd(const struct trace *t, size_t i)
+{
+	const struct ack *a = &t->acks[i];
+	size_t l = i;
+
+	if (a->cwnd)
+		return a->cwnd;
+
+	while (l > 0 && a->ts_us - t->acks[l - 1].ts_us <= a->rtt_us)
+		l--;
+
+	return a->bytes_acked - t->acks[l].bytes_acked;
+}
+
+static void replay(const struct trace *t, struct result *res)
+{
+	struct search_sample sample;
+	struct search_state s;
+	size_t i;
+
+	memset(res, 0, sizeof(*res));
+	search_reset(&s);
+
+	for (i = 0; i < t->nr; i++) {
+		const struct ack *a = &t->acks[i];
+
+		if (!(search_process_delivered(&s, &params, a->ts_us, a->ts_us,
+					       a->bytes_acked, a->rtt_us, a->limited,
+					       &sample) & SEARCH_EXIT))
+			continue;
+
+		res->exit = 1;
+		res->exit_time_us = a->ts_us;
+		res->exit_cwnd = trace_cwnd(t, i);
+		res->rollback_cwnd = res->exit_cwnd;
+		if (params.cwnd_rollback == 1)
+			res->rollback_cwnd = search_rollback_cwnd(res->exit_cwnd,
+								  search_overshoot_bytes(&s, &params),
+								  SIM_INIT_CWND * mss);
+		i++;
+		break;
+	}
+
+	res->acks = i;
+	res->bin_us = s.bin_duration_us;
+}
+
+/* replay() as a userspace transport, through lib/search_cc.h */
+static void replay_lib(const struct trace *t, struct result *res)
+{
+	struct search_cc cc;
+	size_t i;
+
+	memset(res, 0, sizeof(*res));
+	search_cc_init(&cc, &params);
+
+	for (i = 0; i < t->nr; i++) {
+		const struct ack *a = &t->acks[i];
+
+		if (!(search_cc_on_ack_limited(&cc, a->ts_us, a->bytes_acked, a->rtt_us,
+					       a->limited) & SEARCH_EXIT))
+			continue;
+
+		res->exit = 1;
+		res->exit_time_us = a->ts_us;
+		res->exit_cwnd = trace_cwnd(t, i);
+		res->rollback_cwnd = search_cc_exit_cwnd(&cc, res->exit_cwnd,
+							 SIM_INIT_CWND * mss);
+		i++;
+		break;
+	}
+
+	res->acks = i;
+	res->bin_us = cc.state.bin_duration_us;
+}
+
+static u64 clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void run(const struct trace *t)
+{
+	void (*replay_fn)(const struct trace *, struct result *) = use_lib ? replay_lib : replay;
+	struct result res;
+	double ns_per_ack = 0;
+	u64 bdp;
+
+	replay_fn(t, &res);
+
+	if (iterations > 1 && res.acks) {
+		u64 best = 0;
+		struct result r;
+		unsigned long n;
+		int round;
+
+		for (round = 0; round < SIM_TIMING_ROUNDS; round++) {
+			u64 start = clock_ns(), ns;
+
+			for (n = 0; n < iterations; n++)
+				replay_fn(t, &r);
+			ns = clock_ns() - start;
+			if (!best || ns < best)
+				best = ns;
+		}
+		ns_per_ack = (double)best / iterations / res.acks;
+	}
+
+	bdp = bdp_override ? bdp_override : t->bdp ? t->bdp : trace_estimate_bdp(t);
+
+	printf("%s,%zu,%d,%u,%llu,%llu,%llu,%.1f,%.2f,%u,%u\n",
+	       t->name, res.acks, res.exit, res.exit_time_us,
+	       (unsigned long long)res.exit_cwnd,
+	       (unsigned long long)res.rollback_cwnd,
+	       (unsigned long long)bdp,
+	       res.exit && bdp ? ((double)res.exit_cwnd - bdp) * 100 / bdp : 0,
+	       ns_per_ack, res.bin_us, t->choke_us);
+}
+
+int main(int argc, char **argv)
+{
+	const char *profiles[SIM_MAX_PROFILES];
+	unsigned long window = params.window_size_time, thresh = params.thresh;
+	unsigned long confirm = 1;
+	int nr_profiles = 0;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "w:t:i:r:R:c:m:b:n:Ls:H")) != -1) {
+		switch (opt) {
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			thresh = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			params.do_intpld = !!strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			params.cwnd_rollback = !!strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			params.rebin = !!strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			confirm = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mss = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bdp_override = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			use_lib = true;
+			break;
+		case 's':
+			if (nr_profiles == SIM_MAX_PROFILES)
+				usage(argv[0]);
+			profiles[nr_profiles++] = optarg;
+			break;
+		case 'H':
+			header = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!window || window > SEARCH_MAX_WINDOW_SIZE_TIME || thresh > 100 ||
+	    !confirm || confirm > SEARCH_MAX_CONFIRM || !mss || !iterations)
+		usage(argv[0]);
+	params.window_size_time = window;
+	params.thresh = thresh;
+	params.confirm = confirm;
+
+	if (header)
+		printf("trace,acks,exit,exit_time_us,exit_cwnd,rollback_cwnd,bdp,overshoot_pct,ns_per_ack,bin_us,choke_us\n");
+
+	for (i = 0; i < nr_profiles; i++) {
+		struct trace t = { 0 };
+
+		trace_synthetic(&t, profiles[i]);
+		run(&t);
+		free(t.acks);
+	}
+
+	if (optind == argc && !nr_profiles)
+		argv[--optind] = "-";
+
+	for (i = optind; i < argc; i++) {
+		struct trace t = { 0 };
+
+		if (trace_read(&t, argv[i]))
+			return 1;
+		run(&t);
+		free(t.acks);
+	}
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#!/usr/bin/awk -f
+# Convert a log of timestamped `ss -tin` samples into a search_sim trace.
+#
+# Record with, for a single flow:
+#	while :; do date +%s%6N; ss -tinH dst <addr>; done > flow.ss
+# then:
+#	./ss2trace.awk flow.ss > flow.trace
+#
+# A line holding only digits is the timestamp in microseconds of the
+# samples that follow it. Sample lines are scanned for rtt:, bytes_acked:,
+# cwnd: and mss:. The RTT reported by ss is the smoothed RTT, not per ACK.
+
+/^[0-9]+$/ {
+	ts = $1
+	next
+}
+
+/bytes_acked:/ {
+	rtt = bytes = cwnd = 0
+	mss = 1448
+	for (i = 1; i <= NF; i++) {
+		split($i, kv, ":")
+		if (kv[1] == "rtt") {
+			split(kv[2], r, "/")
+			rtt = int(r[1] * 1000)
+		} else if (kv[1] == "bytes_acked") {
+			bytes = kv[2]
+		} else if (kv[1] == "cwnd") {
+			cwnd = kv[2]
+		} else if (kv[1] == "mss") {
+			mss = kv[2]
+		}
+	}
+	if (ts && rtt && bytes != last) {
+		printf "%d %d %d %d\n", ts, bytes, rtt, cwnd * mss
+		last = bytes
+	}
+}